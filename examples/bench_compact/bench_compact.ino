@@ -0,0 +1,92 @@
+// размер образа и скорость кодирования и разбора в обычном, компактном и компактном с LZ форматах.
+// Данные генерируются с постоянным зерном - результаты воспроизводимы между запусками и платами
+#include <Arduino.h>
+#include <GyverDB.h>
+
+#define BENCH_RECORDS 2000  // ячеек в БД
+#define BENCH_REPEAT 10     // повторов каждого замера
+
+GyverDB db;
+
+// псевдослучайные числа с постоянным зерном
+uint32_t seed = 1;
+uint32_t rnd() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// БД настроек: небольшие числа, float, повторяющиеся строки и бинарные данные
+void fill() {
+    const char* words[] = {"ssid", "password", "192.168.1.1", "mqtt.local", "/dev/sensor", "enabled"};
+    char str[48];
+    uint8_t bin[32];
+    for (uint32_t i = 0; i < BENCH_RECORDS; i++) {
+        size_t key = rnd();
+        switch (i % 5) {
+            case 0: db.set(key, (int32_t)(rnd() % 1000)); break;
+            case 1: db.set(key, (rnd() % 2000) / 10.0f); break;
+            case 2: db.set(key, (uint32_t)rnd()); break;
+            case 3: {
+                // порядок вычисления аргументов не задан - числа берутся заранее
+                const char* a = words[rnd() % 6];
+                const char* b = words[rnd() % 6];
+                unsigned long n = rnd() % 100;
+                snprintf(str, sizeof(str), "%s/%s/%lu", a, b, n);
+                db.set(key, (const char*)str);  // строка, а не массив из 48 байт
+            } break;
+            case 4:
+                for (uint8_t k = 0; k < sizeof(bin); k++) bin[k] = (k < 16) ? k : rnd();
+                db.set(key, bin);
+                break;
+        }
+    }
+}
+
+void bench(const char* name, bool compact, bool lz) {
+    db.useCompact(compact, lz);
+    size_t len = db.writeSize();
+    uint8_t* buf = (uint8_t*)malloc(len);
+    if (!buf) {
+        Serial.println("no memory");
+        return;
+    }
+
+    uint32_t enc = 0, dec = 0;
+    bool ok = true;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        uint32_t us = micros();
+        ok &= db.writeTo(buf);
+        enc += micros() - us;
+
+        GyverDB tmp;
+        us = micros();
+        ok &= tmp.readFrom(buf, len);
+        dec += micros() - us;
+        ok &= tmp.length() == db.length();
+    }
+    free(buf);
+
+    // МБ/с по размеру обычного образа: сколько данных БД обрабатывается в секунду
+    db.useCompact(false);
+    float plain = db.writeSize() * (float)BENCH_REPEAT;
+    Serial.print(name);
+    Serial.print(": ");
+    Serial.print(len);
+    Serial.print(" B, encode ");
+    Serial.print(enc ? plain / enc : 0);
+    Serial.print(" MB/s, decode ");
+    Serial.print(dec ? plain / dec : 0);
+    Serial.print(" MB/s");
+    Serial.println(ok ? "" : " ERROR");
+}
+
+void setup() {
+    Serial.begin(115200);
+    fill();
+    bench("plain", false, false);
+    bench("compact", true, false);
+    bench("compact+lz", true, true);
+}
+
+void loop() {
+}
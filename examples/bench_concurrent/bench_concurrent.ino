@@ -0,0 +1,75 @@
+// многопоточная нагрузка на GyverDBConcurrent: читатели в 1, 2 и 4 потоках и один писатель (ESP32, ПК).
+// Печатает операции в секунду и проверяет согласованность прочитанных данных. Для проверки гонок на ПК скетч
+// собирается с -fsanitize=thread вместе с эмулятором Arduino - ThreadSanitizer не должен выдавать предупреждений
+#include <Arduino.h>
+#include <GyverDBConcurrent.h>
+#include <pthread.h>
+
+#include <atomic>
+
+#define BENCH_KEYS 1000   // ячеек в БД
+#define BENCH_OPS 100000  // операций на поток
+
+GyverDBConcurrent db;
+std::atomic<bool> failed{false};
+
+// читатель: строка ячейки всегда совпадает с числом в соседней ячейке того же номера
+void* reader(void* arg) {
+    uint32_t seed = (uintptr_t)arg;
+    for (uint32_t i = 0; i < BENCH_OPS; i++) {
+        seed = seed * 1103515245 + 12345;
+        size_t key = (seed >> 8) % BENCH_KEYS;
+        if (i % 64) {
+            db.getInt(key);
+        } else {
+            // снимок читается без блокировки, пока писатель меняет БД
+            gdb::Snapshot s = db.snapshot();
+            gdb::Entry e = s.get(BENCH_KEYS + key);
+            if (!e.valid() || e.toInt() != s.get(key).toInt()) failed = true;
+        }
+    }
+    return nullptr;
+}
+
+// писатель: пара ячеек меняется одной групповой записью
+void* writer(void* arg) {
+    (void)arg;
+    for (uint32_t i = 0; i < BENCH_OPS / 4; i++) {
+        size_t key = i % BENCH_KEYS;
+        db.write([&](GyverDB& d) {
+            d.set(key, i);
+            d.set(BENCH_KEYS + key, String(i));
+        });
+    }
+    return nullptr;
+}
+
+void bench(uint8_t readers) {
+    pthread_t th[5];
+    uint32_t ms = millis();
+    pthread_create(&th[0], nullptr, writer, nullptr);
+    for (uint8_t i = 1; i <= readers; i++) pthread_create(&th[i], nullptr, reader, (void*)(uintptr_t)i);
+    for (uint8_t i = 0; i <= readers; i++) pthread_join(th[i], nullptr);
+    ms = millis() - ms;
+
+    Serial.print("readers ");
+    Serial.print(readers);
+    Serial.print(": ");
+    Serial.print(ms);
+    Serial.print(" ms, ");
+    Serial.print(ms ? (readers * BENCH_OPS + BENCH_OPS / 4) / ms : 0);
+    Serial.println(" kops/s");
+}
+
+void setup() {
+    Serial.begin(115200);
+    for (uint32_t i = 0; i < BENCH_KEYS; i++) {
+        db.set(i, 0);
+        db.set(BENCH_KEYS + i, "0");
+    }
+    for (uint8_t r = 1; r <= 4; r *= 2) bench(r);
+    Serial.println(failed ? "ERROR: inconsistent read" : "OK");
+}
+
+void loop() {
+}
@@ -0,0 +1,117 @@
+// скорость записи и чтения образа из сегментов в 1, 2 и 4 потоках (ESP32, ПК).
+// Без потоков (DB_USE_PTHREAD не определён) все варианты выполняются в одном потоке
+#include <Arduino.h>
+#include <GyverDB.h>
+
+#define BENCH_RECORDS 20000  // ячеек в БД
+#define BENCH_SEGMENT 1000   // ячеек в сегменте
+#define BENCH_REPEAT 5       // повторов каждого замера
+
+GyverDB db;
+
+// МБ/с по размеру образа и времени в мкс
+float mbps(size_t bytes, uint32_t us) {
+    return us ? bytes / (float)us : 0;
+}
+
+void bench(uint8_t threads, bool compact) {
+    db.useCompact(compact);
+    db.useSegments(BENCH_SEGMENT, threads);
+    size_t len = db.writeSize();
+    uint8_t* buf = (uint8_t*)malloc(len);
+    if (!buf) {
+        Serial.println("no memory");
+        return;
+    }
+
+    uint32_t wr = 0, rd = 0;
+    bool ok = true;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        uint32_t us = micros();
+        ok &= db.writeTo(buf);
+        wr += micros() - us;
+
+        GyverDB tmp;
+        tmp.useSegments(BENCH_SEGMENT, threads);
+        us = micros();
+        ok &= tmp.readFrom(buf, len);
+        rd += micros() - us;
+        ok &= tmp.length() == db.length();
+    }
+    free(buf);
+
+    Serial.print(compact ? "compact" : "plain");
+    Serial.print(" threads ");
+    Serial.print(threads);
+    Serial.print(": ");
+    Serial.print(len);
+    Serial.print(" B, write ");
+    Serial.print(mbps(len * BENCH_REPEAT, wr));
+    Serial.print(" MB/s, read ");
+    Serial.print(mbps(len * BENCH_REPEAT, rd));
+    Serial.print(" MB/s");
+    Serial.println(ok ? "" : " ERROR");
+}
+
+// образ с переставленными записями в сегменте (CRC пересчитаны) не загружается ни в одном, ни в нескольких потоках
+void corrupt() {
+    GyverDB src;
+    for (uint32_t i = 1; i <= 8; i++) src.set(i * 7919, (int32_t)i);
+    src.useSegments(4, 1);
+    size_t len = src.writeSize();
+    uint8_t* buf = (uint8_t*)malloc(len);
+    if (!buf || !src.writeTo(buf)) {
+        free(buf);
+        Serial.println("no memory");
+        return;
+    }
+
+    // заголовок образа, заголовок сегмента, записи по 8 байт. Меняются местами первые две записи сегмента 0
+    uint8_t* seg = buf + sizeof(gdb::image_t);
+    uint8_t* rec = seg + sizeof(gdb::seg_t);
+    uint8_t tmp[8];
+    memcpy(tmp, rec, 8);
+    memcpy(rec, rec + 8, 8);
+    memcpy(rec + 8, tmp, 8);
+    gdb::seg_t h;
+    memcpy(&h, seg, sizeof(h));
+    h.crc = gdb::crc32(0, rec, h.size);
+    memcpy(seg, &h, sizeof(h));
+    uint32_t hcrc = 0;
+    for (uint8_t* p = seg; p < buf + len - 4;) {
+        memcpy(&h, p, sizeof(h));
+        hcrc = gdb::crc32(hcrc, &h, sizeof(h));
+        p += sizeof(h) + h.size;
+    }
+    memcpy(buf + len - 4, &hcrc, 4);
+
+    for (uint8_t t = 1; t <= 2; t++) {
+        GyverDB tmp;
+        tmp.useSegments(4, t);
+        Serial.print("corrupt segment threads ");
+        Serial.print(t);
+        Serial.println(tmp.readFrom(buf, len) ? ": loaded ERROR" : ": rejected");
+    }
+    free(buf);
+}
+
+void setup() {
+    Serial.begin(115200);
+    db.reserve(BENCH_RECORDS);
+    char str[24];
+    for (uint32_t i = 0; i < BENCH_RECORDS; i++) {
+        if (i % 2) {
+            db.set(i * 7919, (int32_t)i);
+        } else {
+            snprintf(str, sizeof(str), "value %lu", (unsigned long)i);
+            db.set(i * 7919, (const char*)str);  // строка, а не массив из 24 байт
+        }
+    }
+
+    for (uint8_t t = 1; t <= 4; t *= 2) bench(t, false);
+    for (uint8_t t = 1; t <= 4; t *= 2) bench(t, true);
+    corrupt();
+}
+
+void loop() {
+}
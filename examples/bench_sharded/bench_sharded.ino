@@ -0,0 +1,93 @@
+// масштабирование записи по потокам: GyverDBConcurrent (одна блокировка) и GyverDBSharded<8> (ESP32, ПК).
+// Каждый поток обновляет свои ячейки числами и строками, печатается скорость при 1, 2, 4 и 8 потоках и время загрузки образа.
+// Строки проверяют, что запись динамических данных в разные части не упирается в общую блокировку снимков
+#include <Arduino.h>
+#include <GyverDBSharded.h>
+#include <pthread.h>
+
+#define BENCH_KEYS 4096   // счётчиков в БД
+#define BENCH_OPS 50000   // обновлений на поток
+#define BENCH_THREADS 8   // наибольшее количество потоков
+
+GyverDBConcurrent single;
+GyverDBSharded<8> sharded;
+
+struct job_t {
+    bool sharded, str;
+    uint8_t idx, threads;
+};
+
+// поток обновляет ячейки с номерами idx, idx + threads...
+void* worker(void* arg) {
+    job_t* j = (job_t*)arg;
+    char str[16];
+    for (uint32_t i = 0; i < BENCH_OPS; i++) {
+        size_t key = (j->idx + (i * j->threads)) % BENCH_KEYS;
+        if (j->str) {
+            snprintf(str, sizeof(str), "v%lu", (unsigned long)i);
+            if (j->sharded) sharded.set(key, (const char*)str);
+            else single.set(key, (const char*)str);
+        } else {
+            if (j->sharded) sharded.set(key, i);
+            else single.set(key, i);
+        }
+    }
+    return nullptr;
+}
+
+// тысяч обновлений в секунду при threads потоках
+uint32_t run(bool isSharded, bool str, uint8_t threads) {
+    pthread_t th[BENCH_THREADS];
+    job_t jobs[BENCH_THREADS];
+    uint32_t ms = millis();
+    for (uint8_t i = 0; i < threads; i++) {
+        jobs[i] = job_t{isSharded, str, i, threads};
+        pthread_create(&th[i], nullptr, worker, &jobs[i]);
+    }
+    for (uint8_t i = 0; i < threads; i++) pthread_join(th[i], nullptr);
+    ms = millis() - ms;
+    return ms ? (uint32_t)threads * BENCH_OPS / ms : 0;
+}
+
+void setup() {
+    Serial.begin(115200);
+    for (uint32_t i = 0; i < BENCH_KEYS; i++) {
+        single.set(i, 0);
+        sharded.set(i, 0);
+    }
+
+    for (uint8_t s = 0; s < 2; s++) {
+        for (uint8_t t = 1; t <= BENCH_THREADS; t *= 2) {
+            uint32_t a = run(false, s, t);
+            uint32_t b = run(true, s, t);
+            Serial.print(s ? "string" : "int");
+            Serial.print(" threads ");
+            Serial.print(t);
+            Serial.print(": concurrent ");
+            Serial.print(a);
+            Serial.print(" kops/s, sharded ");
+            Serial.print(b);
+            Serial.println(" kops/s");
+        }
+    }
+
+    // загрузка образа: ячейки переходят в части без копирования
+    size_t len = sharded.writeSize();
+    uint8_t* buf = (uint8_t*)malloc(len);
+    if (!buf) return;
+    Writer w(buf);
+    sharded.writeTo(w);
+    uint32_t us = micros();
+    bool ok = sharded.readFrom(buf, len);
+    us = micros() - us;
+    free(buf);
+    Serial.print("readFrom ");
+    Serial.print(len);
+    Serial.print(" B: ");
+    Serial.print(us);
+    Serial.print(" us");
+    Serial.println((ok && sharded.length() == BENCH_KEYS) ? "" : " ERROR");
+}
+
+void loop() {
+}
@@ -0,0 +1,190 @@
+// проверка GyverDBConcurrent под нагрузкой: писатель, удаляющий поток, читатели и снимки работают одновременно (ESP32, ПК).
+// Печатает OK или FAIL по каждому шагу. Для проверки гонок на ПК скетч подключается в файл с main(), который вызывает
+// setup() и loop(), и собирается вместе с эмулятором Arduino с ThreadSanitizer:
+//   g++ -std=gnu++11 -fsanitize=thread -g main.cpp -pthread
+// ThreadSanitizer не должен выдавать предупреждений
+#include <Arduino.h>
+#include <GyverDBConcurrent.h>
+#include <pthread.h>
+
+#include <atomic>
+
+#define TEST_KEYS 128     // пар ячеек писателя
+#define TEST_ROUNDS 300   // проходов писателя
+#define TEST_REMOVE 32    // ячеек удаляющего потока
+#define TEST_READS 20000  // операций на читателя
+
+#define KEY_NUM(k) (k)                  // число: раунд в обеих половинах
+#define KEY_STR(k) (TEST_KEYS + (k))    // строка с тем же раундом
+#define KEY_REM(k) (TEST_KEYS * 2 + (k))  // создаётся и удаляется
+
+GyverDBConcurrent db;
+std::atomic<bool> writing{true};
+std::atomic<uint32_t> badRead{0}, badSnap{0}, unstable{0}, badRemove{0};
+
+// значение писателя (Int64): раунд в старшей и младшей половине - разорванное чтение их разведёт
+long long pattern(uint32_t round) {
+    return ((long long)round << 32) | round;
+}
+
+bool wellFormed(long long v) {
+    return (uint32_t)(v >> 32) == (uint32_t)v;
+}
+
+// строка ячейки KEY_STR - номер раунда
+void roundStr(uint32_t round, char* buf) {
+    snprintf(buf, 16, "r%lu", (unsigned long)round);
+}
+
+// ячейка равна строке
+bool equals(const gdb::Entry& e, const char* str) {
+    return e.valid() && e.size() == strlen(str) && !memcmp(e.buffer(), str, e.size());
+}
+
+// строка удаляемой ячейки
+void remStr(size_t k, char* buf) {
+    snprintf(buf, 16, "rem%lu", (unsigned long)k);
+}
+
+// пара ячеек снимка согласована: строка содержит тот же раунд, что и число
+bool pairOk(const gdb::Snapshot& s, size_t k) {
+    gdb::Entry n = s.get(KEY_NUM(k));
+    if (!n.valid()) return false;
+    int64_t v = n.toInt64();
+    char buf[16];
+    roundStr((uint32_t)v, buf);
+    return wellFormed(v) && equals(s.get(KEY_STR(k)), buf);
+}
+
+// писатель: каждый раунд меняет пары ячеек одной группой под блокировкой записи
+void* writer(void*) {
+    char buf[16];
+    for (uint32_t r = 1; r <= TEST_ROUNDS; r++) {
+        for (size_t k = 0; k < TEST_KEYS; k++) {
+            roundStr(r, buf);
+            db.write([&](GyverDB& d) {
+                d.set(KEY_NUM(k), pattern(r));
+                d.set(KEY_STR(k), (const char*)buf);
+            });
+        }
+    }
+    writing = false;
+    return nullptr;
+}
+
+// удаляющий поток: ячейки создаются и удаляются, последним действием создаются
+void* remover(void*) {
+    char buf[16];
+    uint32_t i = 0;
+    while (writing) {
+        size_t k = i++ % TEST_REMOVE;
+        remStr(k, buf);
+        if ((i / TEST_REMOVE) % 2) db.remove(KEY_REM(k));
+        else db.set(KEY_REM(k), (const char*)buf);
+    }
+    for (size_t k = 0; k < TEST_REMOVE; k++) {
+        remStr(k, buf);
+        db.set(KEY_REM(k), (const char*)buf);
+    }
+    return nullptr;
+}
+
+// читатель: отдельные ячейки целые, удаляемые ячейки либо нет, либо с верной строкой, снимки согласованы и не меняются
+void* reader(void* arg) {
+    uint32_t seed = (uintptr_t)arg;
+    char buf[16];
+    for (uint32_t i = 0; i < TEST_READS; i++) {
+        seed = seed * 1103515245 + 12345;
+        size_t k = (seed >> 8) % TEST_KEYS;
+        switch (i % 4) {
+            case 0: {
+                int64_t v = db.getInt64(KEY_NUM(k));
+                if (db.has(KEY_NUM(k)) && !wellFormed(v)) badRead++;
+            } break;
+            case 1: {
+                size_t r = k % TEST_REMOVE;
+                remStr(r, buf);
+                bool ok = true;
+                db.read(KEY_REM(r), [&](const gdb::Entry& e) { ok = equals(e, buf); });
+                if (!ok) badRemove++;
+            } break;
+            case 2:
+                db.read(KEY_STR(k), [&](const gdb::Entry& e) {
+                    if (e.size() < 2 || ((const char*)e.buffer())[0] != 'r') badRead++;
+                });
+                break;
+            case 3:
+                if (i % 64 == 3) {
+                    gdb::Snapshot s = db.snapshot();
+                    if (!s.valid() || (s.has(KEY_NUM(k)) && !pairOk(s, k))) badSnap++;
+                }
+                break;
+        }
+    }
+    return nullptr;
+}
+
+// держит несколько снимков, пока писатель меняет БД: данные снимка не должны меняться. Снимки освобождаются в этом потоке
+void* holder(void*) {
+    const uint8_t n = 4;
+    gdb::Snapshot snaps[n];
+    int64_t first[n];
+    uint32_t i = 0;
+    while (writing) {
+        uint8_t slot = i++ % n;
+        snaps[slot] = db.snapshot();
+        first[slot] = snaps[slot].get(KEY_NUM(0)).toInt64();
+        for (uint8_t s = 0; s < n; s++) {
+            if (!snaps[s].valid()) continue;
+            if (snaps[s].get(KEY_NUM(0)).toInt64() != first[s]) unstable++;
+            for (size_t k = 0; k < TEST_KEYS; k += 16) {
+                if (snaps[s].has(KEY_NUM(k)) && !pairOk(snaps[s], k)) badSnap++;
+            }
+        }
+    }
+    for (uint8_t s = 0; s < n; s++) snaps[s].release();
+    return nullptr;
+}
+
+void check(const char* name, bool ok) {
+    Serial.print(ok ? "OK   " : "FAIL ");
+    Serial.println(name);
+}
+
+void setup() {
+    Serial.begin(115200);
+
+    pthread_t w, rm, h, rd[2];
+    pthread_create(&w, nullptr, writer, nullptr);
+    pthread_create(&rm, nullptr, remover, nullptr);
+    pthread_create(&h, nullptr, holder, nullptr);
+    for (uint8_t i = 0; i < 2; i++) pthread_create(&rd[i], nullptr, reader, (void*)(uintptr_t)(i + 1));
+    for (uint8_t i = 0; i < 2; i++) pthread_join(rd[i], nullptr);
+    pthread_join(h, nullptr);
+    pthread_join(rm, nullptr);
+    pthread_join(w, nullptr);
+
+    check("reads while writing", !badRead);
+    check("reads while removing", !badRemove);
+    check("snapshots consistent", !badSnap);
+    check("snapshots stable", !unstable);
+
+    // итог: последний раунд писателя и все удаляемые ячейки созданы
+    bool final = db.length() == TEST_KEYS * 2 + TEST_REMOVE;
+    char buf[16];
+    roundStr(TEST_ROUNDS, buf);
+    for (size_t k = 0; k < TEST_KEYS; k++) {
+        final &= db.getInt64(KEY_NUM(k)) == pattern(TEST_ROUNDS);
+        db.read(KEY_STR(k), [&](const gdb::Entry& e) { final &= equals(e, buf); });
+    }
+    for (size_t k = 0; k < TEST_REMOVE; k++) {
+        remStr(k, buf);
+        bool ok = false;
+        db.read(KEY_REM(k), [&](const gdb::Entry& e) { ok = equals(e, buf); });
+        final &= ok;
+    }
+    check("final state", final);
+}
+
+void loop() {
+}
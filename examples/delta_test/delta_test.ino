@@ -0,0 +1,149 @@
+// проверка разностей: источник передаёт реплике writeDeltaTo от контрольной точки, реплика применяет applyDelta -
+// на месте (вставок и удалений не больше DB_DELTA_INPLACE) и слиянием. Запускается на плате или на ПК, печатает OK или FAIL по каждому шагу
+#include <Arduino.h>
+#include <GyverDB.h>
+
+// образ в памяти
+class MemImage : public Print {
+   public:
+    ~MemImage() {
+        free(buf);
+    }
+
+    size_t write(uint8_t b) override {
+        return write(&b, 1);
+    }
+    size_t write(const uint8_t* b, size_t n) override {
+        if (len + n > _cap) {
+            size_t cap = (len + n) * 2;
+            uint8_t* p = (uint8_t*)realloc(buf, cap);
+            if (!p) return 0;
+            buf = p;
+            _cap = cap;
+        }
+        memcpy(buf + len, b, n);
+        len += n;
+        return n;
+    }
+
+    void clear() {
+        len = 0;
+    }
+
+    uint8_t* buf = nullptr;
+    size_t len = 0;
+
+   private:
+    size_t _cap = 0;
+};
+
+GyverDB master, cache, late;
+MemImage img;
+int changes = 0;
+
+// данные двух БД совпадают
+bool same(GyverDB& a, GyverDB& b) {
+    if (a.length() != b.length()) return false;
+    for (size_t i = 0; i < a.length(); i++) {
+        gdb::Entry x = a.getN(i), y = b.getN(i);
+        if (x.keyHash() != y.keyHash() || x.type() != y.type() || x.size() != y.size()) return false;
+        if (memcmp(x.buffer(), y.buffer(), x.size())) return false;
+    }
+    return true;
+}
+
+// полный образ источника
+bool full(GyverDB& to) {
+    img.clear();
+    return master.writeTo(img) && to.readFrom(img.buf, img.len);
+}
+
+// разность от точки "r" к кэшу. Считает вызовы onChange кэша - созданные и изменённые ячейки
+bool delta(bool advance = true) {
+    img.clear();
+    changes = 0;
+    size_t size = master.deltaSize("r");
+    return master.writeDeltaTo(img, "r", advance) && img.len == size && cache.applyDelta(img.buf, img.len);
+}
+
+void check(const char* name, bool ok) {
+    Serial.print(ok ? "OK   " : "FAIL ");
+    Serial.println(name);
+}
+
+void setup() {
+    Serial.begin(115200);
+    cache.onChange([](size_t) { changes++; });
+
+    for (int i = 0; i < 200; i++) master.set(i, i * 10);
+    for (int i = 0; i < 20; i++) master.set(1000 + i, "string value");
+    master.checkpoint("r");
+    check("full image", full(cache) && same(master, cache) && master.hasCheckpoint("r"));
+
+    // замены и ровно DB_DELTA_INPLACE вставок и удалений. Ячейка 3 изменилась и вернулась - в разности, но не меняется
+    master.set(1, 111);
+    master.set(1000, "changed string");
+    master.set(3, 31);
+    master.set(3, 30);
+    master.remove(2);
+    for (int i = 0; i < DB_DELTA_INPLACE - 1; i++) master.set(500 + i, i);
+    check("in place", delta() && same(master, cache) && changes == 1 + DB_DELTA_INPLACE && !cache.has(2));
+
+    // удаления уже удалённых у получателя ячеек и ячейки, созданной и удалённой после точки
+    cache.remove(5);
+    master.remove(5);
+    master.set(3000, 1);
+    master.remove(3000);
+    check("tombstones in place", delta() && same(master, cache) && !changes && !cache.has(5) && !cache.has(3000));
+
+    // больше DB_DELTA_INPLACE вставок и удалений
+    for (int i = 0; i < 50; i++) master.set(2000 + i, "new string value");
+    for (int i = 100; i < 120; i++) master.remove(i);
+    master.set(150, 1);
+    master.set(151, 151 * 10);  // то же значение - не изменение
+    check("merge", delta() && same(master, cache) && changes == 50 + 1 && !cache.has(100));
+
+    // удаления слиянием: часть ключей получатель уже удалил
+    for (int i = 2000; i < 2010; i++) cache.remove(i);
+    for (int i = 2000; i < 2030; i++) master.remove(i);
+    master.set(4000, "merged");
+    check("tombstones merge", delta() && same(master, cache) && changes == 1);
+
+    // точка не передвинута (получатель не подтвердил) - та же разность повторяется и не меняет реплику
+    master.set(6, 66);
+    master.set(4001, 1);
+    bool first = delta(false) && changes == 2;
+    check("repeat delta", first && delta() && same(master, cache) && !changes);
+
+    // повреждённая разность не применяется, реплика не меняется
+    master.set(7, 77);
+    img.clear();
+    master.writeDeltaTo(img, "r", false);
+    img.buf[img.len - 6] ^= 1;
+    check("corrupt delta", !cache.applyDelta(img.buf, img.len) && cache.get(7).toInt() == 70 && delta() && same(master, cache));
+
+    // устаревшая точка: получатель запомнил номер изменения, точку удалили, и история до неё стёрта
+    check("late full image", full(late));
+    uint32_t seq = master.seq();
+    master.checkpoint("late", seq);
+    master.set(8, 88);
+    master.removeCheckpoint("late");
+    delta();
+    for (int i = 0; i < 100; i++) master.set(5000 + i, i);
+    delta();
+    master.checkpoint("late", seq);
+    img.clear();
+    bool stale = !master.hasCheckpoint("late") && !master.deltaSize("late") && !master.writeDeltaTo(img, "late") && !img.len;
+    check("stale checkpoint", stale && same(master, cache));
+
+    // после устаревшей точки получатель берёт полный образ и продолжает разностями
+    master.checkpoint("late");
+    bool resync = full(late) && same(master, late);
+    master.set(9, 99);
+    img.clear();
+    resync = resync && master.writeDeltaTo(img, "late") && late.applyDelta(img.buf, img.len);
+    check("resync after stale", resync && same(master, late) && late.get(9).toInt() == 99);
+}
+
+void loop() {
+}
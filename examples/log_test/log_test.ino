@@ -0,0 +1,141 @@
+// проверка режима журнала GyverDBFile: изменения дописываются в журнал, begin() применяет его поверх файла БД,
+// файл перезаписывается, когда журнал больше ratio размеров БД, обрыв в конце журнала не портит остальное.
+// Запускается на плате или на ПК, печатает OK или FAIL по каждому шагу
+#include <Arduino.h>
+#include <GyverDBFile.h>
+#include <LittleFS.h>
+
+#define DB_PATH "/log.db"
+#define LOG_PATH "/log.db.log"
+
+GyverDBFile db(&LittleFS, DB_PATH);
+
+// данные двух БД совпадают
+bool same(GyverDB& a, GyverDB& b) {
+    if (a.length() != b.length()) return false;
+    for (size_t i = 0; i < a.length(); i++) {
+        gdb::Entry x = a.getN(i), y = b.getN(i);
+        if (x.keyHash() != y.keyHash() || x.type() != y.type() || x.size() != y.size()) return false;
+        if (memcmp(x.buffer(), y.buffer(), x.size())) return false;
+    }
+    return true;
+}
+
+size_t fileSize(const char* path) {
+    if (!LittleFS.exists(path)) return 0;
+    File f = LittleFS.open(path, "r");
+    return f ? f.size() : 0;
+}
+
+// отрезать конец файла (питание пропало во время записи)
+bool cut(const char* path, size_t n) {
+    size_t len = fileSize(path);
+    if (len < n) return false;
+    uint8_t* buf = (uint8_t*)malloc(len);
+    if (!buf) return false;
+    File f = LittleFS.open(path, "r");
+    bool ok = f.read(buf, len) == len;
+    f.close();
+    f = LittleFS.open(path, "w");
+    ok = ok && f.write(buf, len - n) == len - n;
+    f.close();
+    free(buf);
+    return ok;
+}
+
+// прочитать БД с диска заново и сравнить
+bool reload(GyverDB& with) {
+    GyverDBFile r(&LittleFS, DB_PATH);
+    r.useLog(true);
+    return r.begin() && same(with, r);
+}
+
+void check(const char* name, bool ok) {
+    Serial.print(ok ? "OK   " : "FAIL ");
+    Serial.println(name);
+}
+
+void setup() {
+    Serial.begin(115200);
+#ifdef ESP32
+    LittleFS.begin(true);
+#else
+    LittleFS.begin();
+#endif
+    LittleFS.remove(DB_PATH);
+    LittleFS.remove(LOG_PATH);
+
+    db.useLog(true, 2);
+    db.begin();
+    for (int i = 0; i < 50; i++) db.set(i, i * 10);
+    for (int i = 0; i < 10; i++) db.set(100 + i, "string value");
+    db.update();
+    size_t dbSize = fileSize(DB_PATH);
+    check("first save writes image", dbSize && !LittleFS.exists(LOG_PATH));
+
+    // изменения дописываются в журнал, файл БД не меняется
+    db.set(1, 11);
+    db.remove(2);
+    db.set(100, "changed");
+    db.update();
+    size_t logSize = fileSize(LOG_PATH);
+    check("append to log", logSize && logSize < dbSize && fileSize(DB_PATH) == dbSize);
+    check("replay over image", reload(db));
+
+    // журнал растёт до ratio размеров БД, затем файл БД переписывается, а журнал удаляется
+    size_t maxLog = 0;
+    bool compacted = false;
+    for (int i = 0; i < 1000 && !compacted; i++) {
+        db.set(i % 50, i);
+        db.update();
+        if (LittleFS.exists(LOG_PATH)) maxLog = fileSize(LOG_PATH);
+        else compacted = true;
+    }
+    check("compaction at ratio", compacted && maxLog > dbSize && maxLog <= dbSize * 2 && reload(db));
+
+    // обрыв последней записи журнала: применяется всё до неё
+    int prev = db.get(4).toInt();
+    db.set(3, 33);
+    db.update();
+    db.set(4, 44);
+    db.update();
+    cut(LOG_PATH, 2);
+    GyverDBFile torn(&LittleFS, DB_PATH);
+    torn.useLog(true);
+    bool ok = torn.begin() && torn.get(3).toInt() == 33 && torn.get(4).toInt() == prev;
+    check("truncated log tail", ok);
+
+    // после обрыва новые изменения не теряются и не смешиваются с остатком оборванной записи
+    torn.set(5, 55);
+    torn.set(101, "after tear");
+    torn.update();
+    check("write after tear", reload(torn));
+
+    // то же при reload() и поэтапной загрузке
+    torn.set(6, 66);
+    torn.update();
+    torn.set(7, 77);
+    torn.update();
+    cut(LOG_PATH, 2);
+    ok = db.reload() && db.get(6).toInt() == 66 && db.get(7).toInt() != 77;
+    db.set(8, 88);
+    db.update();
+    check("reload after tear", ok && reload(db));
+
+    db.set(6, 666);
+    db.update();
+    db.set(7, 777);
+    db.update();
+    cut(LOG_PATH, 2);
+    GyverDBFile async(&LittleFS, DB_PATH);
+    async.useLog(true);
+    ok = async.beginAsync(4);
+    while (async.loading()) async.tick();
+    ok = ok && async.loaded() && async.get(6).toInt() == 666 && async.get(7).toInt() != 777;
+    async.set(9, 99);
+    async.update();
+    check("async load after tear", ok && reload(async));
+}
+
+void loop() {
+}
@@ -0,0 +1,121 @@
+// проверка репликации без связи: источник и реплика соединены каналом в памяти с ограниченной ёмкостью
+// (обратное давление). Запускается на плате или на ПК, печатает OK или FAIL по каждому шагу
+#include <Arduino.h>
+#include <GyverDBReplica.h>
+
+// канал в памяти: кольцевой буфер, write принимает столько, сколько влезает
+class MemPipe : public Stream {
+   public:
+    MemPipe(size_t cap) : _cap(cap) {
+        _buf = (uint8_t*)malloc(cap);
+    }
+    ~MemPipe() {
+        free(_buf);
+    }
+
+    size_t write(uint8_t b) override {
+        return write(&b, 1);
+    }
+    size_t write(const uint8_t* b, size_t len) override {
+        size_t n = 0;
+        while (_buf && n < len && _len < _cap) {
+            _buf[(_head + _len++) % _cap] = b[n++];
+        }
+        if (n < len) stalls++;
+        return n;
+    }
+    int available() override {
+        return _len;
+    }
+    int read() override {
+        if (!_len) return -1;
+        uint8_t b = _buf[_head];
+        _head = (_head + 1) % _cap;
+        _len--;
+        return b;
+    }
+    int peek() override {
+        return _len ? _buf[_head] : -1;
+    }
+
+    // сколько раз источник упёрся в заполненный канал
+    uint32_t stalls = 0;
+
+   private:
+    uint8_t* _buf;
+    size_t _cap, _head = 0, _len = 0;
+};
+
+GyverDB master, cache;
+GyverDBOpLog oplog(master, 8);
+GyverDBReplica replica(cache);
+MemPipe pipe(48);
+
+// данные двух БД совпадают
+bool same(GyverDB& a, GyverDB& b) {
+    if (a.length() != b.length()) return false;
+    for (size_t i = 0; i < a.length(); i++) {
+        gdb::Entry x = a.getN(i), y = b.getN(i);
+        if (x.keyHash() != y.keyHash() || x.type() != y.type() || x.size() != y.size()) return false;
+        if (memcmp(x.buffer(), y.buffer(), x.size())) return false;
+    }
+    return true;
+}
+
+// передать все изменения через канал
+void pump() {
+    for (int i = 0; i < 10000; i++) {
+        bool done = oplog.tick(pipe, 2);
+        replica.tick(pipe);
+        if (done && !pipe.available()) break;
+    }
+}
+
+void check(const char* name, bool ok) {
+    Serial.print(ok ? "OK   " : "FAIL ");
+    Serial.println(name);
+}
+
+void setup() {
+    Serial.begin(115200);
+
+    for (int i = 0; i < 200; i++) master.set(i, i * 10);
+    master.set("name", "replica");
+    check("before sync", replica.needsResync());
+    pump();
+    check("full sync", same(master, cache) && !replica.needsResync() && replica.seq() == oplog.seq());
+
+    master.set(1, 111);
+    master.init(1000, "new");
+    master.init(2, 0);  // уже есть - без изменений
+    master.update(3, 333);
+    master.update(5000, 1);  // нет ячейки - без изменений
+    master.create(2000, gdb::Type::String);
+    master.remove(4);
+    pump();
+    check("set init update create remove", same(master, cache) && cache.has(2000) && !cache.has(4));
+
+    for (int i = 0; i < 100; i++) master.set(10000 + i, "long string value to fill the pipe");
+    pump();
+    check("back-pressure", same(master, cache) && pipe.stalls > 0);
+
+    master.clear();
+    master.set(1, 1);
+    pump();
+    check("clear", same(master, cache) && cache.length() == 1);
+
+    // кадр теряется в канале - следующий не продолжает цепочку реплики
+    master.set(2, 2);
+    oplog.tick(pipe, 1);
+    while (pipe.available()) pipe.read();
+    master.set(3, 3);
+    pump();
+    check("gap detected", replica.needsResync() && !cache.has(3));
+
+    oplog.resync();
+    pump();
+    check("resync", same(master, cache) && !replica.needsResync() && !replica.errors());
+}
+
+void loop() {
+}
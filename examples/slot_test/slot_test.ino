@@ -0,0 +1,142 @@
+// проверка режима слотов GyverDBFile: записи идут по кругу в n файлов с номером записи и CRC, begin() выбирает
+// новейший целый слот, а при оборванном или повреждённом слоте - предыдущую копию.
+// Запускается на плате или на ПК, печатает OK или FAIL по каждому шагу
+#include <Arduino.h>
+#include <GyverDBFile.h>
+#include <LittleFS.h>
+
+#define DB_PATH "/slot.db"
+#define SLOTS 3
+
+GyverDBFile db(&LittleFS, DB_PATH);
+
+// номер записи: ячейка "gen" в БД и номер в заголовке слота совпадают
+uint32_t gen = 0;
+
+String slotPath(uint8_t i) {
+    return String(DB_PATH) + "." + String(i);
+}
+
+size_t fileSize(const String& path) {
+    if (!LittleFS.exists(path.c_str())) return 0;
+    File f = LittleFS.open(path.c_str(), "r");
+    return f ? f.size() : 0;
+}
+
+// номер записи из заголовка слота [magic32, seq32, len32, crc32]
+uint32_t slotSeq(uint8_t i) {
+    uint32_t h[4] = {};
+    File f = LittleFS.open(slotPath(i).c_str(), "r");
+    if (f) f.read((uint8_t*)h, sizeof(h));
+    return h[1];
+}
+
+// слот с наибольшим номером записи
+uint8_t newest() {
+    uint8_t best = 0;
+    for (uint8_t i = 1; i < SLOTS; i++) {
+        if (slotSeq(i) > slotSeq(best)) best = i;
+    }
+    return best;
+}
+
+// изменить файл: отрезать cut байт с конца (обрыв записи) или инвертировать байт flip от конца (повреждение данных)
+bool damage(const String& path, size_t cut, size_t flip) {
+    size_t len = fileSize(path);
+    if (len <= cut || len < flip) return false;
+    uint8_t* buf = (uint8_t*)malloc(len);
+    if (!buf) return false;
+    File f = LittleFS.open(path.c_str(), "r");
+    bool ok = f.read(buf, len) == len;
+    f.close();
+    if (flip) buf[len - flip] ^= 0xff;
+    f = LittleFS.open(path.c_str(), "w");
+    ok = ok && f.write(buf, len - cut) == len - cut;
+    f.close();
+    free(buf);
+    return ok;
+}
+
+// записать следующее поколение
+bool save() {
+    db.set("gen", ++gen);
+    db.set(gen % 16, gen);
+    return db.update();
+}
+
+// поколение, прочитанное с диска заново. 0 - не прочиталось
+uint32_t load() {
+    GyverDBFile r(&LittleFS, DB_PATH);
+    r.useSlots(SLOTS);
+    return r.begin() ? r.get("gen").toInt() : 0;
+}
+
+void check(const char* name, bool ok) {
+    Serial.print(ok ? "OK   " : "FAIL ");
+    Serial.println(name);
+}
+
+void setup() {
+    Serial.begin(115200);
+#ifdef ESP32
+    LittleFS.begin(true);
+#else
+    LittleFS.begin();
+#endif
+    LittleFS.remove(DB_PATH);
+    for (uint8_t i = 0; i < SLOTS; i++) LittleFS.remove(slotPath(i).c_str());
+
+    db.useSlots(SLOTS);
+    db.begin();
+    for (int i = 0; i < 16; i++) db.set(i, 0);
+
+    // записи идут по кругу, номер записи растёт, основной файл не пишется
+    bool ring = true;
+    for (uint8_t i = 0; i < SLOTS * 2; i++) {
+        ring &= save() && newest() == i % SLOTS && slotSeq(i % SLOTS) == gen;
+    }
+    check("write ring", ring && !fileSize(DB_PATH));
+    check("newest slot", load() == gen);
+
+    // оборванная запись новейшего слота - загружается предыдущая копия
+    damage(slotPath(newest()), 5, 0);
+    check("torn newest slot", load() == gen - 1);
+
+    // следующая запись идёт поверх оборванного слота и снова становится новейшей
+    GyverDBFile r(&LittleFS, DB_PATH);
+    r.useSlots(SLOTS);
+    r.begin();
+    r.set("gen", gen + 10);
+    bool ok = r.update() && load() == gen + 10;
+    check("write after torn slot", ok);
+
+    // повреждённые данные новейшего слота (размер цел, CRC не совпал) - предыдущая копия
+    damage(slotPath(newest()), 0, 3);
+    check("crc-bad newest slot", load() == gen - 1);
+
+    // два новейших слота повреждены - третья копия
+    uint8_t bad = newest();
+    uint8_t prev = (bad + SLOTS - 1) % SLOTS;
+    damage(slotPath(prev), 0, 3);
+    check("two bad slots", load() == gen - 2);
+
+    // запись после повреждённого слота получает номер больше всех существующих и не затирает последнюю целую копию
+    GyverDBFile w(&LittleFS, DB_PATH);
+    w.useSlots(SLOTS);
+    w.begin();
+    uint8_t good = (bad + 1) % SLOTS;
+    w.set("gen", gen + 20);
+    ok = w.update() && newest() != good && slotSeq(newest()) > slotSeq(bad) && load() == gen + 20;
+    check("write after crc-bad slot", ok && fileSize(slotPath(good)));
+
+    // поэтапная загрузка проверяет CRC по ходу и при ошибке читает предыдущую копию
+    damage(slotPath(newest()), 0, 3);
+    GyverDBFile a(&LittleFS, DB_PATH);
+    a.useSlots(SLOTS);
+    ok = a.beginAsync(4);
+    while (a.loading()) a.tick();
+    check("async load of crc-bad slot", ok && a.loaded() && a.get("gen").toInt() == gen - 2);
+}
+
+void loop() {
+}
@@ -7,14 +7,33 @@
 #include "utils/access.h"
 #include "utils/anytype.h"
 #include "utils/block.h"
+#include "utils/changelog.h"
+#include "utils/diff.h"
 #include "utils/entry.h"
+#include "utils/io.h"
+#include "utils/merkle.h"
+#include "utils/segments.h"
+#include "utils/snapshot.h"
+#include "utils/subscribers.h"
+#include "utils/updates.h"
 
-// #define DB_NO_UPDATES  // убрать стек обновлений
+// #define DB_NO_UPDATES  // убрать очередь обновлений, курсоры изменений и контрольные точки разностей
 // #define DB_NO_FLOAT    // убрать поддержку float
 // #define DB_NO_INT64    // убрать поддержку int64
 // #define DB_NO_CONVERT  // не конвертировать данные (принудительно менять тип ячейки, keepTypes не работает)
 
+#ifndef DB_DELTA_INPLACE
+#define DB_DELTA_INPLACE 4  // applyDelta: до стольких вставок и удалений разность применяется на месте, больше - слиянием
+#endif
+
+class GyverDBFile;
+template <uint8_t N>
+class GyverDBSharded;
+
 class GyverDB : private gtl::stack<gdb::block_t> {
+    friend class GyverDBFile;
+    template <uint8_t N>
+    friend class GyverDBSharded;
     typedef gtl::stack<gdb::block_t> ST;
     typedef void (*ChangeCallback)(size_t hash);
 
@@ -36,37 +55,69 @@ class GyverDB : private gtl::stack<gdb::block_t> {
         reserve(reserveEntries);
     }
 
-    // GyverDB(const GyverDB& db) = delete;
-    // GyverDB(GyverDB&& db) = delete;
-
-    // GyverDB& operator=(const GyverDB& db) = delete;
-    // GyverDB& operator=(GyverDB&& db) = delete;
-
-    //     GyverDB(GyverDB& db) : ST() {
-    //         move(db);
-    //     }
-    //     GyverDB(GyverDB&& db) noexcept {
-    //         move(db);
-    //     }
-    //     GyverDB& operator=(GyverDB db) {
-    //         move(db);
-    //         return *this;
-    //     }
-
-    //     void move(GyverDB& db) noexcept {
-    //         ST::move(db);
-    // #ifndef DB_NO_UPDATES
-    //         _updates.move(db._updates);
-    // #endif
-    //         gtl::swap(_keepTypes, db._keepTypes);
-    //         gtl::swap(_useUpdates, db._useUpdates);
-    //         gtl::swap(_cache, db._cache);
-    //         gtl::swap(_cache_h, db._cache_h);
-    //         _change();
-    //     }
+    GyverDB(const GyverDB& db) = delete;
+    GyverDB& operator=(const GyverDB& db) = delete;
+
+    // перемещение: данные, настройки, обработчики и снимки переходят в новый объект
+    GyverDB(GyverDB&& db) noexcept {
+        move(db);
+    }
+    GyverDB& operator=(GyverDB&& db) noexcept {
+        move(db);
+        return *this;
+    }
+
+    // обменяться с другой БД всем содержимым: данными, настройками, обработчиками и снимками
+    void move(GyverDB& db) noexcept {
+        if (&db == this) return;
+        _swapData(db);
+#ifndef DB_NO_UPDATES
+        _updates.swap(db._updates);
+        _log.swap(db._log);
+        _checkpoints.swap(db._checkpoints);
+        gtl::swap(_useLog, db._useLog);
+#endif
+        _subs.swap(db._subs);
+        _merkle.swap(db._merkle);
+        gtl::swap(_change_cb, db._change_cb);
+        gtl::swap(_keepTypes, db._keepTypes);
+        gtl::swap(_imgMode, db._imgMode);
+        gtl::swap(_threads, db._threads);
+        gtl::swap(_segSize, db._segSize);
+        gtl::swap(_useUpdates, db._useUpdates);
+        gtl::swap(_changed, db._changed);
+        gtl::swap(_update, db._update);
+    }
+
+    // обменяться с другой БД только данными (O(1), незагруженные данные наследника сначала загружаются). Настройки и обработчики остаются на месте,
+    // обработчики обеих БД получают только действительно изменившиеся ячейки (сравнение слиянием)
+    void swap(GyverDB& db) {
+        if (&db == this) return;
+        // незагруженные данные наследника (ленивое чтение, блобы) переходят вместе с ячейками
+        _fetchAll();
+        db._fetchAll();
+        _swapData(db);
+        _onSwap();
+        db._onSwap();
+        gdb::diffBlocks(db._buf, db._len, _buf, _len, [&](const gdb::block_t* prev, const gdb::block_t* cur) {
+            size_t hash = prev ? prev->keyHash() : cur->keyHash();
+            _swapNotify(hash, cur);
+            db._swapNotify(hash, prev);
+        });
+    }
 
     ~GyverDB() {
+        _subs.reset();
         clear();
+        gdb::snap_t::detachAll(&_snap);
+#ifndef DB_NO_UPDATES
+        // курсоры, пережившие БД, больше ничего не читают
+        while (_cursors) {
+            Cursor* c = _cursors;
+            c->_unlink();
+            c->_db = nullptr;
+        }
+#endif
     }
 
     gdb::Access operator[](size_t hash) {
@@ -81,11 +132,30 @@ class GyverDB : private gtl::stack<gdb::block_t> {
         _keepTypes = keep;
     }
 
-    // использовать стек обновлений (умолч. false)
+    // компактный образ writeTo: ключи разностями, числа varint. lz - сжимать строки и бинарные данные (умолч. false)
+    void useCompact(bool compact, bool lz = false) {
+        _imgMode = compact ? (DB_IMAGE_COMPACT | (lz ? DB_IMAGE_LZ : 0)) : 0;
+    }
+
+    // образ writeTo из независимых сегментов по records ячеек (0 - без сегментов). threads - потоки для кодирования
+    // и разбора сегментов в readFrom (умолч. 0 и 1)
+    void useSegments(uint32_t records, uint8_t threads = 1) {
+        _segSize = records;
+        _threads = threads ? threads : 1;
+    }
+
+    // использовать очередь обновлений (умолч. false)
     void useUpdates(bool use) {
         _useUpdates = use;
     }
 
+    // размер очереди обновлений и поведение при переполнении (умолч. 32, DropOldest). Очищает очередь
+    void setUpdatesSize(uint16_t size, gdb::Overflow policy = gdb::Overflow::DropOldest) {
+#ifndef DB_NO_UPDATES
+        _updates.setSize(size, policy);
+#endif
+    }
+
     // вывести всё содержимое БД
     void dump(Print& p) {
         p.print(F("DB dump: "));
@@ -101,62 +171,46 @@ class GyverDB : private gtl::stack<gdb::block_t> {
             p.print(F(" ["));
             p.print(_buf[i].typeRead());
             p.print(F("]: "));
-            p.println(gdb::Entry(_buf[i]));
+            p.println(gdb::Entry(_hot(i)));
         }
     }
 
     // экспортный размер БД (для writeTo)
     size_t writeSize() {
-        size_t sz = 0;
-        for (size_t i = 0; i < length(); i++) {
-            if (!_buf[i].valid()) continue;
-            if (_buf[i].isDynamic()) {
-                if (!_buf[i].ptr()) continue;
-                sz += 4 + 2;  // typehash + size
-                sz += _buf[i].size();
-            } else {
-                sz += 4 + 4;  // typehash + data
-            }
-        }
-        sz += 2;  // len
-        return sz;
+        if (_watchGet) return _exportSize();
+        return gdb::segmentsSize(_buf, _len, _imgMode, _segSize);
     }
 
     // экспортировать БД в Stream (напр. файл)
     template <typename T>
     bool writeTo(T& writer) {
-        // [db len] [hash32, value32] [hash32, size16, data...]
-
-#define _DB_WRITE(x) wr += writer.write((uint8_t*)&x, sizeof(x))
-
-        size_t wr = 0;
-        uint16_t len = length();
-        _DB_WRITE(len);
-        for (size_t i = 0; i < length(); i++) {
-            if (!_buf[i].valid()) continue;
-            if (_buf[i].isDynamic()) {
-                if (!_buf[i].ptr()) continue;
-                _DB_WRITE(_buf[i].typehash);
-                uint16_t size = _buf[i].size();
-                _DB_WRITE(size);
-                wr += writer.write((uint8_t*)_buf[i].buffer(), size);
-            } else {
-                _DB_WRITE(_buf[i].typehash);
-                _DB_WRITE(_buf[i].data);
-            }
+        if (_watchGet) {
+            gdb::WriterSink<T> sink(writer);
+            return _export(sink);
         }
-        return wr == writeSize();
+        return gdb::writeSegments(writer, _buf, _len, _imgMode, _segSize, _threads);
     }
 
     // экспортировать БД в буфер размера writeSize()
     bool writeTo(uint8_t* buffer) {
         Writer wr(buffer);
-        return writeTo(wr);
+        if (_watchGet) {
+            gdb::WriterSink<Writer> sink(wr);
+            return _export(sink);
+        }
+        return gdb::writeSegmentsRaw(wr, _buf, _len, _imgMode, _segSize, _threads);
     }
 
     // импортировать БД из Stream (напр. файл)
     bool readFrom(Stream& stream, size_t len) {
-        return readFrom(Reader(stream, len));
+        gdb::StreamSource src(stream);
+        return readFrom(src, len);
+    }
+
+    // импортировать БД из источника (файл, сокет). Читается блоками по DB_IO_BUF байт, не больше len
+    bool readFrom(gdb::Source& source, size_t len) {
+        gdb::BufReader buf(source, len);
+        return readFrom(Reader(buf, len));
     }
 
     // импортировать БД из буфера
@@ -164,8 +218,137 @@ class GyverDB : private gtl::stack<gdb::block_t> {
         return readFrom(Reader(buffer, len));
     }
 
+    // дерево хэшей диапазонов ключей для сверки реплик: 2^depth листьев (до DB_MERKLE_MAX, умолч. 0 - выкл).
+    // Изменение ячейки помечает её лист, хэши пересчитываются при чтении. Вернёт false при нехватке памяти
+    bool useMerkle(uint8_t depth) {
+        return _merkle.begin(depth);
+    }
+
+    // глубина дерева хэшей
+    uint8_t merkleDepth() {
+        return _merkle.depth();
+    }
+
+    // корневой хэш: у одинаковых БД совпадает (0 - пустая БД или дерево выключено)
+    uint32_t merkleRoot() {
+        return merkleNode(0, 0);
+    }
+
+    // хэш узла idx на уровне level (0 - корень, на уровне 2^level узлов)
+    uint32_t merkleNode(uint8_t level, uint32_t idx) {
+        if (!_merkleUpdate() || level > _merkle.depth() || idx >= (1ul << level)) return 0;
+        return _merkle.node(level, idx);
+    }
+
+    // хэши всех узлов уровня level подряд (2^level значений) для отправки реплике. nullptr - дерево выключено
+    const uint32_t* merkleLevel(uint8_t level) {
+        if (!_merkleUpdate() || level > _merkle.depth()) return nullptr;
+        return _merkle.level(level);
+    }
+
+    // диапазон хэшей ключей узла [from, to]
+    void merkleRange(uint8_t level, uint32_t idx, size_t& from, size_t& to) {
+        _merkle.range(level, idx, from, to);
+    }
+
+    // сверить узлы уровня level с хэшами реплики peer (merkleLevel реплики). f(uint32_t idx, size_t from, size_t to)
+    // вызывается для отличающихся узлов с диапазоном их ключей. Вернёт количество отличий
+    template <typename F>
+    size_t merkleCompare(uint8_t level, const uint32_t* peer, F f) {
+        const uint32_t* own = merkleLevel(level);
+        if (!own) return 0;
+        size_t n = 0;
+        for (uint32_t i = 0; i < (1ul << level); i++) {
+            if (own[i] == peer[i]) continue;
+            size_t from, to;
+            _merkle.range(level, i, from, to);
+            f(i, from, to);
+            n++;
+        }
+        return n;
+    }
+
+    // сравнить с другой БД за один проход слиянием отсортированных ячеек.
+    // f(gdb::Diff kind, size_t hash, const gdb::Entry& from, const gdb::Entry& to) вызывается для отличающихся ячеек
+    // по порядку ключей: from - ячейка этой БД, to - другой (отсутствующая - пустая)
+    template <typename F>
+    void diff(GyverDB& db, F f) {
+        size_t j = 0;
+        _diff(
+            [&](const gdb::block_t*& b) {
+                b = (j < db._len) ? &db._hot(j++) : nullptr;
+                return true;
+            },
+            f);
+    }
+
+    // сравнить с образом writeTo из Stream, не загружая его: записи читаются по одной. Вернёт false при ошибке формата или CRC
+    // (обработчик к этому моменту мог получить часть отличий)
+    template <typename F>
+    bool diff(Stream& stream, size_t len, F f) {
+        gdb::StreamSource src(stream);
+        return diff(src, len, f);
+    }
+
+    // сравнить с образом из источника (файл, сокет). Читается блоками по DB_IO_BUF байт, не больше len
+    template <typename F>
+    bool diff(gdb::Source& source, size_t len, F f) {
+        gdb::BufReader buf(source, len);
+        return _diffImage(Reader(buf, len), f);
+    }
+
+    // сравнить с образом из буфера
+    template <typename F>
+    bool diff(const uint8_t* image, size_t len, F f) {
+        return _diffImage(Reader(image, len), f);
+    }
+
+    // размер патча до db (для writePatchTo)
+    size_t patchSize(GyverDB& db) {
+        size_t sz = gdb::imageSize(nullptr, 0);
+        diff(db, [&](gdb::Diff kind, size_t, const gdb::Entry&, const gdb::Entry& to) {
+            sz += (kind == gdb::Diff::Removed) ? 8 : gdb::recordSize(to.type(), to.buffer(), to.size(), DB_IMAGE_VER);
+        });
+        return sz;
+    }
+
+    // экспортировать патч, превращающий эту БД в db: разность для applyDelta из отличающихся ячеек db и удалений
+    template <typename T>
+    bool writePatchTo(T& writer, GyverDB& db) {
+        size_t n = 0;
+        diff(db, [&](gdb::Diff, size_t, const gdb::Entry&, const gdb::Entry&) { n++; });
+        gdb::WriterSink<T> sink(writer);
+        gdb::BufWriter buf(sink);
+        gdb::ImageWriter<gdb::BufWriter> img(buf);
+        img.begin(n, true, DB_IMAGE_DELTA);
+        diff(db, [&](gdb::Diff kind, size_t hash, const gdb::Entry&, const gdb::Entry& to) {
+            if (kind == gdb::Diff::Removed) img.tombstone(hash);
+            else img.record(to.type(), hash, to.buffer(), to.size());
+        });
+        bool ok = img.end();
+        return buf.flush() && ok;
+    }
+
+    // экспортировать патч, превращающий эту БД в образ из буфера. Вернёт false при ошибке образа
+    template <typename T>
+    bool writePatchTo(T& writer, const uint8_t* image, size_t len) {
+        size_t n = 0;
+        if (!diff(image, len, [&](gdb::Diff, size_t, const gdb::Entry&, const gdb::Entry&) { n++; })) return 0;
+        gdb::WriterSink<T> sink(writer);
+        gdb::BufWriter buf(sink);
+        gdb::ImageWriter<gdb::BufWriter> img(buf);
+        img.begin(n, true, DB_IMAGE_DELTA);
+        diff(image, len, [&](gdb::Diff kind, size_t hash, const gdb::Entry&, const gdb::Entry& to) {
+            if (kind == gdb::Diff::Removed) img.tombstone(hash);
+            else img.record(to.type(), hash, to.buffer(), to.size());
+        });
+        bool ok = img.end();
+        return buf.flush() && ok;
+    }
+
     // создать ячейку. Если существует - перезаписать пустой с новым типом
     bool create(size_t hash, gdb::Type type, uint16_t reserve = 0) {
+        if (_isReserved(hash)) return 0;
         pos_t pos = _search(hash);
         if (!pos.exists) {
             _cache = -1;
@@ -173,12 +356,14 @@ class GyverDB : private gtl::stack<gdb::block_t> {
             if (!block.init(reserve)) return 0;
             if (insert(pos.idx, block)) {
                 _change();
+                _notify(hash);
                 return 1;
             } else {
                 block.reset();
             }
         } else {
             _setChanged(hash);
+            _detach(_buf[pos.idx], false);
             _buf[pos.idx].updateType(type);
             return _buf[pos.idx].init(reserve);
         }
@@ -197,7 +382,12 @@ class GyverDB : private gtl::stack<gdb::block_t> {
     // стереть все ячейки (не освобождает зарезервированное место)
     void clear() {
         _cache = -1;
-        while (length()) pop().reset();
+        while (length()) {
+            gdb::block_t& b = pop();
+            _notify(b.keyHash());
+            _detach(b, false);
+            b.reset();
+        }
         _change();
     }
 
@@ -215,6 +405,9 @@ class GyverDB : private gtl::stack<gdb::block_t> {
                 }
             }
             if (!found) {
+                _notify(hash);
+                _detach(_buf[i], false);
+                _buf[i].reset();
                 ST::remove(i);
                 _change();
             }
@@ -248,15 +441,24 @@ class GyverDB : private gtl::stack<gdb::block_t> {
         return sz;
     }
 
+    // снимок БД для согласованного чтения и экспорта, пока БД продолжает изменяться.
+    // Массив ячеек копируется целиком (8 байт на ячейку, O(length)), данные ячеек общие и копируются только при изменении ячейки в БД
+    gdb::Snapshot snapshot() {
+        _fetchAll();  // снимок видит данные, а не пустые незагруженные ячейки
+        gdb::snap_t* s = gdb::snap_t::create(_buf, _len, &_snap);
+        if (s) s->mode = _imgMode;
+        return gdb::Snapshot(s);
+    }
+
     // получить ячейку
     gdb::Entry get(size_t hash) {
-        if (~_cache && _cache_h == hash) return gdb::Entry(_buf[_cache]);
+        if (~_cache && _cache_h == hash) return gdb::Entry(_hot(_cache));
         else {
             pos_t pos = _search(hash);
             if (pos.exists) {
                 _cache = pos.idx;
                 _cache_h = hash;
-                return gdb::Entry(_buf[_cache]);
+                return gdb::Entry(_hot(_cache));
             }
         }
         return gdb::Entry();
@@ -266,8 +468,18 @@ class GyverDB : private gtl::stack<gdb::block_t> {
     }
 
     // получить ячейку по порядку
-    gdb::Entry getN(int idx) {
-        return (idx < (int)_len) ? gdb::Entry(_buf[idx]) : gdb::Entry();
+    gdb::Entry getN(int idx) const {
+        if (idx < 0 || idx >= (int)_len) return gdb::Entry();
+        return gdb::Entry(_watchGet ? const_cast<GyverDB*>(this)->_hot(idx) : _buf[idx]);
+    }
+
+    // порядковый номер ячейки или -1, если её нет. Не использует кэш - безопасно для параллельного чтения
+    int indexOf(size_t hash) const {
+        pos_t pos = _search(hash);
+        return pos.exists ? pos.idx : -1;
+    }
+    int indexOf(const Text& key) const {
+        return indexOf(key.hash());
     }
 
     // удалить ячейку
@@ -275,9 +487,13 @@ class GyverDB : private gtl::stack<gdb::block_t> {
         pos_t pos = _search(hash);
         if (pos.exists) {
             _cache = -1;
+            _detach(_buf[pos.idx], false);
             _buf[pos.idx].reset();
             ST::remove(pos.idx);
             _change();
+            _notify(hash);
+        } else {
+            _onRemoveMissing(hash);
         }
     }
     void remove(const Text& key) {
@@ -310,6 +526,34 @@ class GyverDB : private gtl::stack<gdb::block_t> {
         _change_cb = cb;
     }
 
+    // подписаться на создание, изменение и удаление ячейки. Вернёт id подписки (0 - ошибка)
+    uint16_t subscribe(size_t hash, gdb::SubCallback cb) {
+        return _subs.add(&hash, 1, cb);
+    }
+    uint16_t subscribe(const Text& key, gdb::SubCallback cb) {
+        return subscribe(key.hash(), cb);
+    }
+
+    // подписаться на группу ячеек (массив хэшей). Вернёт id подписки (0 - ошибка)
+    uint16_t subscribe(const size_t* hashes, size_t len, gdb::SubCallback cb) {
+        return _subs.add(hashes, len, cb);
+    }
+
+    // подписаться на все ячейки. Вернёт id подписки (0 - ошибка)
+    uint16_t subscribe(gdb::SubCallback cb) {
+        return _subs.add(nullptr, 0, cb);
+    }
+
+    // отписаться
+    void unsubscribe(uint16_t id) {
+        _subs.remove(id);
+    }
+
+    // откладывать вызов подписчиков до tick() (умолч. false). queue - размер очереди отложенных событий
+    void deferNotify(bool defer, uint16_t queue = 32) {
+        _subs.defer(defer, queue);
+    }
+
     // есть непрочитанные изменения
     bool updatesAvailable() {
 #ifndef DB_NO_UPDATES
@@ -325,7 +569,7 @@ class GyverDB : private gtl::stack<gdb::block_t> {
 #endif
     }
 
-    // получить хеш обновления из стека
+    // получить хеш самого старого обновления из очереди
     size_t updateNext() {
 #ifndef DB_NO_UPDATES
         return _updates.pop();
@@ -333,7 +577,213 @@ class GyverDB : private gtl::stack<gdb::block_t> {
         return 0;
     }
 
-    virtual bool tick() { return 0; }
+    // очередь переполнялась в режиме Overflow::Resync - нужна полная синхронизация. Сбрасывает флаг
+    bool updatesOverflow() {
+#ifndef DB_NO_UPDATES
+        return _updates.resync();
+#endif
+        return 0;
+    }
+
+#ifndef DB_NO_UPDATES
+    // курсор изменений. Каждый курсор независимо читает ключи, изменённые (созданные, удалённые) после его позиции.
+    // Живые курсоры известны БД: журнал хранит изменения только новее самого старого из них
+    class Cursor {
+        friend class GyverDB;
+
+       public:
+        Cursor(GyverDB* db = nullptr) : _db(db) {
+            if (_db) _pos = _db->_log.seq();
+            _link();
+        }
+        Cursor(GyverDB* db, uint32_t pos) : _db(db), _pos(pos) {
+            _link();
+        }
+        Cursor(const Cursor& c) : _db(c._db), _pos(c._pos) {
+            _link();
+        }
+        Cursor& operator=(const Cursor& c) {
+            if (this != &c) {
+                _unlink();
+                _db = c._db;
+                _pos = c._pos;
+                _link();
+            }
+            return *this;
+        }
+        ~Cursor() {
+            _unlink();
+        }
+
+        // есть непрочитанные изменения
+        bool available() const {
+            return _db && _db->_log.available(_pos);
+        }
+
+        // получить хэш следующего изменённого ключа (0 если изменений нет)
+        size_t next() {
+            size_t hash = 0;
+            if (_db) _db->_log.next(_pos, hash);
+            return hash;
+        }
+
+        // часть изменений могла быть потеряна из-за нехватки памяти - нужна полная синхронизация
+        bool lost() const {
+            return _db && _db->_log.lost(_pos);
+        }
+
+        // пропустить непрочитанные изменения
+        void skip() {
+            if (_db) _pos = _db->_log.seq();
+        }
+
+        // номер последнего прочитанного изменения
+        uint32_t position() const {
+            return _pos;
+        }
+
+       private:
+        GyverDB* _db;
+        uint32_t _pos = 0;
+        Cursor* _prev = nullptr;
+        Cursor* _next = nullptr;
+
+        void _link() {
+            if (!_db) return;
+            _next = _db->_cursors;
+            if (_next) _next->_prev = this;
+            _db->_cursors = this;
+        }
+        void _unlink() {
+            if (!_db) return;
+            if (_prev) _prev->_next = _next;
+            else _db->_cursors = _next;
+            if (_next) _next->_prev = _prev;
+            _prev = _next = nullptr;
+        }
+    };
+
+    // создать курсор с текущей позиции. Включает журнал изменений
+    Cursor cursor() {
+        _useLog = true;
+        return Cursor(this);
+    }
+
+    // номер последнего изменения БД (растёт при каждом изменении, если создан курсор)
+    uint32_t seq() {
+        return _log.seq();
+    }
+
+    // номер последнего изменения ячейки (0 если не менялась после создания курсора)
+    uint32_t seq(size_t hash) {
+        return _log.seq(hash);
+    }
+    uint32_t seq(const Text& key) {
+        return seq(key.hash());
+    }
+
+    // запомнить контрольную точку для writeDeltaTo: текущее состояние БД или номер изменения seq. Включает журнал изменений
+    bool checkpoint(size_t id) {
+        return checkpoint(id, _log.seq());
+    }
+    bool checkpoint(size_t id, uint32_t seq) {
+        _useLog = true;
+        return _checkpoints.put(id, seq);
+    }
+    bool checkpoint(const Text& name) {
+        return checkpoint(name.hash());
+    }
+    bool checkpoint(const Text& name, uint32_t seq) {
+        return checkpoint(name.hash(), seq);
+    }
+
+    // удалить контрольную точку
+    void removeCheckpoint(size_t id) {
+        _checkpoints.remove(id);
+    }
+    void removeCheckpoint(const Text& name) {
+        removeCheckpoint(name.hash());
+    }
+
+    // от контрольной точки можно записать разность: точка есть и изменения после неё не потеряны. Иначе нужен полный образ
+    bool hasCheckpoint(size_t id) {
+        uint32_t* s = _checkpoints.get(id);
+        return s && !_log.lost(*s);
+    }
+    bool hasCheckpoint(const Text& name) {
+        return hasCheckpoint(name.hash());
+    }
+
+    // размер разности от контрольной точки (для writeDeltaTo). 0 - разность не записать
+    size_t deltaSize(size_t id) {
+        gtl::stack<uint32_t> keys;
+        if (!_deltaKeys(id, keys)) return 0;
+        size_t sz = gdb::imageSize(nullptr, 0);
+        for (size_t i = 0; i < keys.length(); i++) {
+            int idx = indexOf(keys[i]);
+            if (idx < 0) {
+                sz += 8;
+                continue;
+            }
+            const gdb::block_t& b = _hot(idx);
+            sz += gdb::recordSize(b.type(), b.buffer(), b.size(), DB_IMAGE_VER);
+        }
+        return sz;
+    }
+    size_t deltaSize(const Text& name) {
+        return deltaSize(name.hash());
+    }
+
+    // экспортировать разность от контрольной точки: ячейки, созданные и изменённые после неё, и удаления - по порядку ключей.
+    // advance - передвинуть точку на текущее состояние. Вернёт false, если точки нет или изменения после неё потеряны (нужен writeTo)
+    template <typename T>
+    bool writeDeltaTo(T& writer, size_t id, bool advance = true) {
+        gtl::stack<uint32_t> keys;
+        if (!_deltaKeys(id, keys)) return 0;
+        uint32_t seq = _log.seq();
+        gdb::WriterSink<T> sink(writer);
+        gdb::BufWriter buf(sink);
+        gdb::ImageWriter<gdb::BufWriter> img(buf);
+        img.begin(keys.length(), true, DB_IMAGE_DELTA);
+        for (size_t i = 0; i < keys.length(); i++) {
+            int idx = indexOf(keys[i]);
+            if (idx >= 0) img.record(_hot(idx));
+            else img.tombstone(keys[i]);
+        }
+        bool ok = img.end();
+        ok = buf.flush() && ok;
+        if (ok && advance) checkpoint(id, seq);
+        return ok;
+    }
+    template <typename T>
+    bool writeDeltaTo(T& writer, const Text& name, bool advance = true) {
+        return writeDeltaTo(writer, name.hash(), advance);
+    }
+#endif
+
+    // применить разность writeDeltaTo (или образ writeTo поверх БД без удаления остальных ячеек) из Stream.
+    // Разность читается и проверяется целиком, затем сливается с БД за один проход. При ошибке БД не меняется.
+    // Обработчики получат только изменившиеся ячейки, после слияния
+    bool applyDelta(Stream& stream, size_t len) {
+        gdb::StreamSource src(stream);
+        return applyDelta(src, len);
+    }
+
+    // применить разность из источника (файл, сокет). Читается блоками по DB_IO_BUF байт, не больше len
+    bool applyDelta(gdb::Source& source, size_t len) {
+        gdb::BufReader buf(source, len);
+        return _applyDelta(Reader(buf, len));
+    }
+
+    // применить разность из буфера
+    bool applyDelta(const uint8_t* buffer, size_t len) {
+        return _applyDelta(Reader(buffer, len));
+    }
+
+    // тикер, вызывать в loop. Вызывает отложенных подписчиков, вернёт true если они были
+    virtual bool tick() {
+        return _subs.tick();
+    }
 
     // hook
     static bool setHook(void* db, size_t hash, const gdb::AnyType& val) {
@@ -343,24 +793,263 @@ class GyverDB : private gtl::stack<gdb::block_t> {
    protected:
     bool _update = 0;
 
+    // ячейка создана, изменена или удалена (для наследников)
+    virtual void _onChange(size_t hash) {
+        (void)hash;
+    }
+
+    // наследник загружает данные ячеек по требованию: при чтении ячейки вызывается _fetch()
+    bool _watchGet = false;
+
+    // служебный ключ наследника: запись в него через set/init/update/create и разности отклоняется (0 - нет)
+    size_t _reserved = 0;
+
+    // чтение ячейки (для наследников). Динамическая ячейка без данных - данные не загружены
+    virtual void _fetch(gdb::block_t& b) {
+        (void)b;
+    }
+
+    // ключ занят наследником
+    bool _isReserved(size_t hash) {
+        return _reserved && (hash & DB_HASH_MASK) == _reserved;
+    }
+
+    // ячейка с загруженными данными
+    gdb::block_t& _hot(int idx) {
+        if (_watchGet) _fetch(_buf[idx]);
+        return _buf[idx];
+    }
+
+    // загрузить данные всех ячеек
+    void _fetchAll() {
+        if (!_watchGet) return;
+        for (size_t i = 0; i < _len; i++) _fetch(_buf[i]);
+    }
+
+    // ячейки заменены обменом данных: незагруженных больше нет (для наследников)
+    virtual void _onSwap() {}
+
+    // экспортный размер с данными, которых нет в памяти (для наследников с _watchGet)
+    virtual size_t _exportSize() {
+        size_t sz = gdb::imageSize(nullptr, 0);
+        for (size_t i = 0; i < _len; i++) {
+            const gdb::block_t& b = _hot(i);
+            sz += gdb::recordSize(b.type(), b.buffer(), b.size(), DB_IMAGE_VER);
+        }
+        return sz;
+    }
+
+    // записать образ с данными, которых нет в памяти (для наследников с _watchGet). Обычный формат без сегментов
+    virtual bool _export(gdb::Sink& sink) {
+        gdb::BufWriter buf(sink);
+        gdb::ImageWriter<gdb::BufWriter> img(buf);
+        img.begin(_len);
+        for (size_t i = 0; i < _len; i++) img.record(_hot(i));
+        bool ok = img.end();
+        return buf.flush() && ok;
+    }
+
+    // удаление отсутствующей ячейки (для наследников)
+    virtual void _onRemoveMissing(size_t hash) {
+        (void)hash;
+    }
+
+    // записать ячейку целиком (тип и данные как есть). Блок переходит во владение БД
+    bool _replace(gdb::block_t& block) {
+        size_t hash = block.keyHash();
+        pos_t pos = _search(hash);
+        if (pos.exists) {
+            if (gdb::blockEquals(_buf[pos.idx], block)) {
+                block.reset();
+                return 1;
+            }
+            _detach(_buf[pos.idx], false);
+            _buf[pos.idx].reset();
+            _buf[pos.idx] = block;
+            _setChanged(hash);
+        } else {
+            _cache = -1;
+            if (!insert(pos.idx, block)) {
+                block.reset();
+                return 0;
+            }
+            _change();
+            _notify(hash);
+        }
+        return 1;
+    }
+
+    // добавить ячейку при поэтапной загрузке. Существующая ячейка не заменяется.
+    // Журнал изменений не пополняется - это не новое изменение
+    bool _load(gdb::block_t& block) {
+        size_t hash = block.keyHash();
+        pos_t pos = _search(hash);
+        if (pos.exists) {
+            block.reset();
+            return 1;
+        }
+        _cache = -1;
+        if (!insert(pos.idx, block)) {
+            block.reset();
+            return 0;
+        }
+        _changed = true;
+        _merkle.touch(hash);
+        _subs.notify(hash);
+        if (_change_cb) _change_cb(hash);
+        return 1;
+    }
+
+    // добавить ячейку прочитанного образа, блок переходит во владение БД. Ключи отсортированного образа
+    // добавляются в конец без поиска, остальные - заменой
+    bool _take(gdb::block_t& block, bool sorted) {
+        if (!sorted || (length() && _buf[length() - 1].keyHash() >= block.keyHash())) return _replace(block);
+        if (!push(block)) {
+            block.reset();
+            return 0;
+        }
+        _notify(block.keyHash());
+        return 1;
+    }
+
+    // образ прочитан: обработчик изменений получает все ячейки
+    void _takeEnd() {
+        _change();
+        if (_change_cb) {
+            for (size_t i = 0; i < length(); i++) {
+                _change_cb(_buf[i].keyHash());
+            }
+        }
+    }
+
+    // обменять массив ячеек и цепочку снимков
+    void _swapData(GyverDB& db) noexcept {
+        ST t;
+        t.move(*this);
+        ST::move(db);
+        db.ST::move(t);
+        gdb::snap_t::swapChains(&_snap, &db._snap);
+        _cache = db._cache = -1;
+    }
+
+    // ячейка изменилась при обмене данными. cur - ячейка после обмена или nullptr если её больше нет
+    void _swapNotify(size_t hash, const gdb::block_t* cur) {
+        if (cur) {
+            _setChanged(hash);
+        } else {
+            _change();
+            _notify(hash);
+        }
+    }
+
    private:
     ChangeCallback _change_cb = nullptr;
-    int16_t _cache = -1;
+    int _cache = -1;
     size_t _cache_h = 0;
     bool _keepTypes = true;
     bool _useUpdates = false;
+    uint8_t _imgMode = 0;
+    uint8_t _threads = 1;
+    uint32_t _segSize = 0;
     bool _changed = false;
+    gdb::Subscribers _subs;
+    gdb::snap_head_t _snap{nullptr};
+    gdb::Merkle _merkle;
+
+    // пересчитать изменённые листья дерева хэшей. Лист - ячейки подряд с одинаковыми старшими битами хэша
+    bool _merkleUpdate() {
+        if (!_merkle.valid()) return 0;
+        _merkle.update([this](uint32_t leaf) {
+            uint8_t shift = DB_HASH_SIZE - _merkle.depth();
+            uint32_t crc = 0;
+            for (int i = _search((size_t)leaf << shift).idx; i < (int)_len && (_buf[i].keyHash() >> shift) == leaf; i++) {
+                crc = gdb::Merkle::cell(crc, _hot(i));
+            }
+            return crc;
+        });
+        return 1;
+    }
 
 #ifndef DB_NO_UPDATES
-    gtl::stack<size_t> _updates;
+    gdb::Updates _updates;
+    gdb::ChangeLog _log;
+    gdb::HashMap<uint32_t> _checkpoints;  // номера изменений именованных контрольных точек
+    Cursor* _cursors = nullptr;           // живые курсоры этой БД
+    bool _useLog = false;
+
+    // самая старая позиция, которую ещё могут прочитать курсоры и контрольные точки
+    uint32_t _logFloor() {
+        uint32_t floor = _log.seq();
+        for (Cursor* c = _cursors; c; c = c->_next) {
+            if (c->_pos < floor) floor = c->_pos;
+        }
+        _checkpoints.forEach([&floor](size_t, uint32_t& seq) {
+            if (seq < floor) floor = seq;
+        });
+        return floor;
+    }
+
+    // ключи, изменённые после контрольной точки, по порядку
+    bool _deltaKeys(size_t id, gtl::stack<uint32_t>& keys) {
+        uint32_t* s = _checkpoints.get(id);
+        if (!s || _log.lost(*s)) return 0;
+        uint32_t pos = *s;
+        size_t hash;
+        while (_log.next(pos, hash)) {
+            if (!keys.push(hash)) return 0;
+        }
+        if (keys.length()) {
+            qsort(&keys[0], keys.length(), sizeof(uint32_t), [](const void* a, const void* b) -> int {
+                uint32_t ha = *(const uint32_t*)a, hb = *(const uint32_t*)b;
+                return (ha > hb) - (ha < hb);
+            });
+        }
+        return 1;
+    }
 #endif
 
     void _setChanged(size_t hash) {
         _change();
         if (_change_cb) _change_cb(hash);
 #ifndef DB_NO_UPDATES
-        if (_useUpdates && _updates.indexOf(hash) < 0) _updates.push(hash);
+        if (_useUpdates) _updates.push(hash);
+#endif
+        _notify(hash);
+    }
+
+    // динамические данные ячейки видны в снимке - отдать их снимку. copy - оставить ячейке свою копию.
+    // Снимки могут освобождаться в других потоках - цепочка проверяется под блокировкой. Без снимков блокировка
+    // не берётся: новый снимок создаётся только в потоке записи, поэтому пустая цепочка здесь не станет непустой
+    bool _detach(gdb::block_t& b, bool copy) {
+        if (!b.isDynamic() || !b.ptr() || !_snap) return 1;
+        gdb::snap_t::Lock l;
+        gdb::snap_t* snap = _snap;
+        if (!snap || !snap->refers(b.keyHash(), b.ptr())) return 1;
+        void* old = b.ptr();
+        if (copy) {
+            size_t len = b.realLen(b.size());
+            void* p = malloc(len);
+            if (!p) return 0;
+            memcpy(p, old, len);
+            b.data = (gdb::data_t)(uintptr_t)p;
+        } else {
+            b.data = 0;
+        }
+        snap->own(b.keyHash(), old);
+        return 1;
+    }
+
+    // ячейка создана, изменена или удалена
+    void _notify(size_t hash) {
+#ifndef DB_NO_UPDATES
+        if (_useLog) {
+            _log.push(hash);
+            if (_log.full()) _log.trim(_logFloor());
+        }
 #endif
+        _merkle.touch(hash);
+        _subs.notify(hash);
+        _onChange(hash);
     }
 
     struct pos_t {
@@ -373,7 +1062,7 @@ class GyverDB : private gtl::stack<gdb::block_t> {
         _update = true;
     }
 
-    pos_t _search(size_t hash) {
+    pos_t _search(size_t hash) const {
         if (!length()) return pos_t{0, false};
         hash &= DB_HASH_MASK;  // to 29bit
         int low = 0, high = length() - 1;
@@ -388,48 +1077,198 @@ class GyverDB : private gtl::stack<gdb::block_t> {
 
     bool readFrom(Reader reader) {
         clear();
-        uint16_t len = 0;
-        if (!reader.read(len)) return 0;
-        reserve(len);
+        gdb::ImageReader img;
+        if (!img.begin(reader) || (img.flags & DB_IMAGE_DELTA)) return 0;
+        reserve(img.len);
+        // отсортированный образ загружается добавлением в конец без поиска
+        bool sorted = img.flags & DB_IMAGE_SORTED;
 
-        while (reader.available()) {
-            uint32_t typehash;
-            if (!reader.read(typehash)) return 0;
+        if ((img.flags & DB_IMAGE_SEGMENTS) && _threads > 1) {
+            // сегменты разбираются параллельно и выдаются по порядку
+            bool ok = gdb::readSegments(reader, img, _threads, [this](gdb::block_t& block) {
+                return _take(block, true);
+            });
+            if (!ok) return 0;
+        } else {
+            while (img.available(reader)) {
+                gdb::block_t block;
+                if (!img.next(reader, block) || !_take(block, sorted)) return 0;
+            }
+            if (!img.end(reader)) return 0;
+        }
+        _takeEnd();
+        return 1;
+    }
 
-            gdb::block_t block;
-            block.typehash = typehash;
-            if (block.isDynamic()) {
-                uint16_t size;
-                if (!reader.read(size)) return 0;
-                if (!block.reserve(size)) return 0;
-                if (!reader.read(block.buffer(), size)) {
-                    block.reset();
-                    return 0;
+    // слияние с отсортированной последовательностью ячеек: next(const block_t*&) выдаёт следующую ячейку,
+    // nullptr в конце. Вернёт false, если next вернул false (ошибка источника)
+    template <typename N, typename F>
+    bool _diff(N next, F f) {
+        const gdb::block_t* b;
+        if (!next(b)) return 0;
+        size_t i = 0;
+        while (i < _len || b) {
+            if (!b || (i < _len && _buf[i].keyHash() < b->keyHash())) {
+                f(gdb::Diff::Removed, _buf[i].keyHash(), gdb::Entry(_hot(i)), gdb::Entry());
+                i++;
+                continue;
+            }
+            if (i >= _len || b->keyHash() < _buf[i].keyHash()) {
+                f(gdb::Diff::Added, b->keyHash(), gdb::Entry(), gdb::Entry(*b));
+            } else {
+                if (!gdb::blockEquals(_hot(i), *b)) f(gdb::Diff::Changed, b->keyHash(), gdb::Entry(_buf[i]), gdb::Entry(*b));
+                i++;
+            }
+            if (!next(b)) return 0;
+        }
+        return 1;
+    }
+
+    // сравнить с образом: записи читаются по одной, порядок ключей проверяется по ходу
+    template <typename F>
+    bool _diffImage(Reader reader, F f) {
+        gdb::ImageReader img;
+        if (!img.begin(reader) || (img.flags & DB_IMAGE_DELTA) || !(img.flags & DB_IMAGE_SORTED)) return 0;
+        gdb::block_t cur;
+        bool first = true;
+        bool ok = _diff(
+            [&](const gdb::block_t*& b) {
+                size_t prev = cur.keyHash();
+                cur.reset();
+                b = nullptr;
+                if (!img.available(reader)) return img.end(reader);
+                if (!img.next(reader, cur) || (!first && cur.keyHash() <= prev)) return false;
+                first = false;
+                b = &cur;
+                return true;
+            },
+            f);
+        cur.reset();
+        return ok;
+    }
+
+    // слияние разности в новый массив out. Заменённые и удалённые ячейки переходят на место записей разности и освобождаются после.
+    // Незагруженные данные (наследник с _watchGet) не подгружаются для сравнения - такая ячейка просто заменяется
+    void _mergeDelta(ST& delta, ST& out, gtl::stack<uint32_t>& notes) {
+        size_t i = 0, n = delta.length();
+        for (size_t j = 0; j < n; j++) {
+            gdb::block_t d = delta[j];
+            size_t hash = d.keyHash();
+            while (i < _len && _buf[i].keyHash() < hash) out.push(_buf[i++]);
+            bool exists = i < _len && _buf[i].keyHash() == hash;
+            if (d.type() == gdb::Type::None) {
+                if (exists) {
+                    delta[j] = _buf[i++];
+                    notes.push(hash | 0x80000000ul);
                 }
-                block.setSize(size);
+            } else if (exists && gdb::blockEquals(_buf[i], d)) {
+                out.push(_buf[i++]);
             } else {
-                if (!reader.read(block.data)) return 0;
+                delta[j] = exists ? _buf[i++] : gdb::block_t();
+                out.push(d);
+                notes.push(hash);
             }
+        }
+        while (i < _len) out.push(_buf[i++]);
+        for (size_t j = 0; j < n; j++) {
+            _detach(delta[j], false);
+            delta[j].reset();
+        }
+        ST::move(out);
+        out.reset();
+        _cache = -1;
+    }
 
-            if (!push(block)) {
+    bool _applyDelta(Reader reader) {
+        gdb::ImageReader img;
+        if (!img.begin(reader)) return 0;
+        ST delta, out;
+        gtl::stack<uint32_t> notes;  // изменённые ключи, старший бит - удаление
+        bool ok = delta.reserve(img.len);
+        while (ok && img.available(reader)) {
+            gdb::block_t block;
+            if (!img.next(reader, block)) {
+                ok = false;
+            } else if (!delta.push(block)) {
                 block.reset();
-                return 0;
+                ok = false;
             }
         }
-        _change();
+        ok = ok && img.end(reader);
+        size_t n = delta.length();
+        if (ok && n && !(img.flags & DB_IMAGE_SORTED)) {
+            qsort(&delta[0], n, sizeof(gdb::block_t), [](const void* a, const void* b) -> int {
+                size_t ha = ((const gdb::block_t*)a)->keyHash(), hb = ((const gdb::block_t*)b)->keyHash();
+                return (ha > hb) - (ha < hb);
+            });
+        }
+        for (size_t j = 1; ok && j < n; j++) ok = delta[j - 1].keyHash() < delta[j].keyHash();  // повтор ключа
+        for (size_t j = 0; ok && j < n; j++) ok = !_isReserved(delta[j].keyHash());
 
-        if (_change_cb) {
-            for (size_t i = 0; i < length(); i++) {
-                _change_cb(_buf[i].keyHash());
+        // вставки и удаления сдвигают массив. Если их немного - разность применяется на месте (замены не сдвигают ничего),
+        // иначе слиянием в новый массив за один проход
+        size_t moves = 0;
+        for (size_t j = 0; ok && j < n && moves <= DB_DELTA_INPLACE; j++) {
+            if (_search(delta[j].keyHash()).exists == (delta[j].type() == gdb::Type::None)) moves++;
+        }
+        bool inplace = moves <= DB_DELTA_INPLACE;
+        ok = ok && notes.reserve(n) && (inplace ? reserve(_len + moves) : out.reserve(_len + n));
+        if (!ok) {
+            for (size_t j = 0; j < n; j++) delta[j].reset();
+            return 0;
+        }
+
+        if (inplace) {
+            // место под вставки зарезервировано - разность применяется целиком
+            for (size_t j = 0; j < n; j++) {
+                gdb::block_t& d = delta[j];
+                size_t hash = d.keyHash();
+                pos_t pos = _search(hash);
+                if (d.type() == gdb::Type::None) {
+                    if (pos.exists) {
+                        _detach(_buf[pos.idx], false);
+                        _buf[pos.idx].reset();
+                        ST::remove(pos.idx);
+                        notes.push(hash | 0x80000000ul);
+                    }
+                    d.reset();
+                } else if (pos.exists && gdb::blockEquals(_buf[pos.idx], d)) {
+                    d.reset();
+                } else {
+                    if (pos.exists) {
+                        _detach(_buf[pos.idx], false);
+                        _buf[pos.idx].reset();
+                        _buf[pos.idx] = d;
+                    } else {
+                        insert(pos.idx, d);
+                    }
+                    notes.push(hash);
+                }
+            }
+            _cache = -1;
+        } else {
+            _mergeDelta(delta, out, notes);
+        }
+
+        for (size_t k = 0; k < notes.length(); k++) {
+            size_t hash = notes[k] & DB_HASH_MASK;
+            if (notes[k] & 0x80000000ul) {
+                _change();
+                _notify(hash);
+            } else {
+                _setChanged(hash);
             }
         }
         return 1;
     }
 
     bool _put(size_t hash, const gdb::AnyType& val, Putmode mode) {
+        if (_isReserved(hash)) return 0;
         pos_t pos = _search(hash);
         if (pos.exists) {
             if (mode == Putmode::Init && _buf[pos.idx].type() == val.type) return 0;
+            _hot(pos.idx);
+            if (!_detach(_buf[pos.idx], true)) return 0;
 
             if (_buf[pos.idx].update(val.type, val.ptr, val.len, (_keepTypes && mode != Putmode::Init))) {
                 _setChanged(hash);
@@ -443,6 +1282,7 @@ class GyverDB : private gtl::stack<gdb::block_t> {
             if (block.write(val.ptr, val.len)) {
                 if (insert(pos.idx, block)) {
                     _change();
+                    _notify(hash);
                     return 1;
                 } else {
                     block.reset();
@@ -0,0 +1,256 @@
+#pragma once
+#include <Arduino.h>
+
+#include "GyverDB.h"
+#include "utils/rwlock.h"
+
+#ifdef DB_USE_PTHREAD
+#include <atomic>
+#endif
+
+template <uint8_t N>
+class GyverDBSharded;
+
+// потокобезопасная БД: параллельное чтение из нескольких задач, запись по очереди
+class GyverDBConcurrent {
+    template <uint8_t N>
+    friend class GyverDBSharded;
+
+   public:
+    GyverDBConcurrent(uint16_t reserveEntries = 0) : _db(reserveEntries) {
+        _id = ++_ids();
+    }
+
+    // ================== READ ==================
+
+    // БД содержит ячейку
+    bool has(size_t hash) {
+        gdb::RWLock::Read l(_lock);
+        return _index(hash) >= 0;
+    }
+    bool has(const Text& key) {
+        return has(key.hash());
+    }
+
+    // прочитать ячейку: f(const gdb::Entry& entry) вызывается под блокировкой чтения. Вернёт false если ячейки нет
+    template <typename F>
+    bool read(size_t hash, F f) {
+        gdb::RWLock::Read l(_lock);
+        int idx = _index(hash);
+        if (idx < 0) return 0;
+        const gdb::Entry entry = _db.getN(idx);
+        f(entry);
+        return 1;
+    }
+    template <typename F>
+    bool read(const Text& key, F f) {
+        return read(key.hash(), f);
+    }
+
+    // тип ячейки
+    gdb::Type type(size_t hash) {
+        gdb::Type t = gdb::Type::None;
+        read(hash, [&](const gdb::Entry& e) { t = e.type(); });
+        return t;
+    }
+
+    bool getBool(size_t hash) {
+        bool v = false;
+        read(hash, [&](const gdb::Entry& e) { v = e.toBool(); });
+        return v;
+    }
+    int32_t getInt(size_t hash) {
+        int32_t v = 0;
+        read(hash, [&](const gdb::Entry& e) { v = e.toInt(); });
+        return v;
+    }
+    int64_t getInt64(size_t hash) {
+        int64_t v = 0;
+        read(hash, [&](const gdb::Entry& e) { v = e.toInt64(); });
+        return v;
+    }
+    float getFloat(size_t hash) {
+        float v = 0;
+        read(hash, [&](const gdb::Entry& e) { v = e.toFloat(); });
+        return v;
+    }
+    String getString(size_t hash) {
+        String v;
+        read(hash, [&](const gdb::Entry& e) { v = e.toString(); });
+        return v;
+    }
+
+    // скопировать данные ячейки в переменную того же размера
+    template <typename T>
+    bool getTo(size_t hash, T& dest) {
+        bool res = false;
+        read(hash, [&](const gdb::Entry& e) { res = e.writeTo(dest); });
+        return res;
+    }
+
+    // скопировать данные ячейки в буфер длиной len. Вернёт размер данных ячейки
+    size_t getBytes(size_t hash, void* buf, size_t len) {
+        size_t size = 0;
+        read(hash, [&](const gdb::Entry& e) {
+            size = e.size();
+            if (size <= len) e.writeBytes(buf);
+        });
+        return size;
+    }
+
+    // количество ячеек
+    size_t length() {
+        gdb::RWLock::Read l(_lock);
+        return _db.length();
+    }
+
+    // экспортный размер БД (для writeTo)
+    size_t writeSize() {
+        gdb::RWLock::Read l(_lock);
+        return _db.writeSize();
+    }
+
+    // экспортировать БД в Stream (напр. файл). Параллельные чтения не блокируются
+    template <typename T>
+    bool writeTo(T& writer) {
+        gdb::RWLock::Read l(_lock);
+        return _db.writeTo(writer);
+    }
+
+    // вывести всё содержимое БД
+    void dump(Print& p) {
+        gdb::RWLock::Read l(_lock);
+        _db.dump(p);
+    }
+
+    // снимок БД для согласованного чтения без блокировки. Снимок можно читать, копировать и освобождать в любом потоке
+    gdb::Snapshot snapshot() {
+        gdb::RWLock::Read l(_lock);
+        return _db.snapshot();
+    }
+
+    // ================== WRITE ==================
+
+    bool set(size_t hash, gdb::AnyType val) {
+        gdb::RWLock::Write l(_lock);
+        _ver++;
+        return _db.set(hash, val);
+    }
+    bool set(const Text& key, gdb::AnyType val) { return set(key.hash(), val); }
+
+    bool init(size_t hash, gdb::AnyType val) {
+        gdb::RWLock::Write l(_lock);
+        _ver++;
+        return _db.init(hash, val);
+    }
+    bool init(const Text& key, gdb::AnyType val) { return init(key.hash(), val); }
+
+    bool update(size_t hash, gdb::AnyType val) {
+        gdb::RWLock::Write l(_lock);
+        _ver++;
+        return _db.update(hash, val);
+    }
+    bool update(const Text& key, gdb::AnyType val) { return update(key.hash(), val); }
+
+    // создать ячейку. Если существует - перезаписать пустой с новым типом
+    bool create(size_t hash, gdb::Type type, uint16_t reserve = 0) {
+        gdb::RWLock::Write l(_lock);
+        _ver++;
+        return _db.create(hash, type, reserve);
+    }
+
+    // удалить ячейку
+    void remove(size_t hash) {
+        gdb::RWLock::Write l(_lock);
+        _ver++;
+        _db.remove(hash);
+    }
+    void remove(const Text& key) { remove(key.hash()); }
+
+    // стереть все ячейки
+    void clear() {
+        gdb::RWLock::Write l(_lock);
+        _ver++;
+        _db.clear();
+    }
+
+    // импортировать БД из Stream (напр. файл)
+    bool readFrom(Stream& stream, size_t len) {
+        gdb::RWLock::Write l(_lock);
+        _ver++;
+        return _db.readFrom(stream, len);
+    }
+
+    // импортировать БД из источника (файл, сокет)
+    bool readFrom(gdb::Source& source, size_t len) {
+        gdb::RWLock::Write l(_lock);
+        _ver++;
+        return _db.readFrom(source, len);
+    }
+
+    // импортировать БД из буфера
+    bool readFrom(const uint8_t* buffer, size_t len) {
+        gdb::RWLock::Write l(_lock);
+        _ver++;
+        return _db.readFrom(buffer, len);
+    }
+
+    // заменить данные на данные другой БД за O(1) (напр. загруженной и проверенной заранее). Обработчики получат только изменившиеся ячейки
+    void swap(GyverDB& db) {
+        gdb::RWLock::Write l(_lock);
+        _ver++;
+        _db.swap(db);
+    }
+
+    // доступ ко всей БД под блокировкой записи: f(GyverDB& db). Для настройки, подписок, курсоров и групповых изменений
+    template <typename F>
+    void write(F f) {
+        gdb::RWLock::Write l(_lock);
+        _ver++;
+        f(_db);
+    }
+
+    // тикер, вызывать в loop. Обработчики изменений вызываются под блокировкой записи - из них нельзя обращаться к этому объекту
+    bool tick() {
+        gdb::RWLock::Write l(_lock);
+        return _db.tick();
+    }
+
+   private:
+    GyverDB _db;
+    gdb::RWLock _lock;
+    uint32_t _ver = 0;
+    uint32_t _id = 0;
+
+    // номера объектов для кэша поиска. Объекты могут создаваться в разных потоках
+#ifdef DB_USE_PTHREAD
+    static std::atomic<uint32_t>& _ids() {
+        static std::atomic<uint32_t> ids{0};
+        return ids;
+    }
+#else
+    static uint32_t& _ids() {
+        static uint32_t ids = 0;
+        return ids;
+    }
+#endif
+
+    // поиск с кэшем в локальной памяти потока. Вызывать под блокировкой
+    int _index(size_t hash) {
+        struct cache_t {
+            uint32_t id;
+            uint32_t ver;
+            size_t hash;
+            int idx;
+        };
+#ifdef DB_USE_PTHREAD
+        static thread_local cache_t cache{};
+#else
+        static cache_t cache{};
+#endif
+        if (cache.id == _id && cache.ver == _ver && cache.hash == hash) return cache.idx;
+        int idx = _db.indexOf(hash);
+        cache = cache_t{_id, _ver, hash, idx};
+        return idx;
+    }
+};
@@ -1,70 +1,1654 @@
 #pragma once
 #include <Arduino.h>
-#include <FS.h>
 
 #include "GyverDB.h"
+#include "utils/asyncwriter.h"
+#include "utils/bufstream.h"
+#include "utils/crc.h"
+#include "utils/posix.h"
+#include "utils/storage.h"
+
+#define DB_SLOT_MAGIC 0x53424447  // "GDBS"
+#define DB_BLOB_KEY 0x1B10B5ED    // служебная ячейка индекса блобов в образе
 
 class GyverDBFile : public GyverDB {
    public:
+    typedef void (*SaveCallback)(bool ok);
+
+#ifdef DB_USE_FS
     GyverDBFile(fs::FS* nfs = nullptr, const char* path = nullptr, uint32_t tout = 10000) {
         setFS(nfs, path);
         _tout = tout;
+        _reserved = DB_BLOB_KEY;
+    }
+#else
+    GyverDBFile() {
+        _reserved = DB_BLOB_KEY;
+    }
+#endif
+
+    // хранилище вместо файловой системы Arduino (напр. gdb::PosixStorage на ПК)
+    GyverDBFile(gdb::Storage* storage, const char* path, uint32_t tout = 10000) {
+        setStorage(storage, path);
+        _tout = tout;
+        _reserved = DB_BLOB_KEY;
+    }
+
+    GyverDBFile(GyverDBFile&& db) noexcept : GyverDB(static_cast<GyverDB&&>(db)) {
+        _reserved = DB_BLOB_KEY;
+        _moveFile(db);
+    }
+    GyverDBFile& operator=(GyverDBFile&& db) noexcept {
+        GyverDB::move(db);
+        _moveFile(db);
+        return *this;
     }
 
     ~GyverDBFile() {
         update();
+#ifdef DB_USE_PTHREAD
+        _async.end();
+#endif
     }
 
+#ifdef DB_USE_FS
     // установить файловую систему и имя файла
     void setFS(fs::FS* nfs, const char* path) {
-        _fs = nfs;
+        _fsStorage = gdb::FSStorage(nfs);
+        setStorage(nfs ? &_fsStorage : nullptr, path);
+    }
+#endif
+
+    // установить хранилище и имя файла
+    void setStorage(gdb::Storage* storage, const char* path) {
+        _st = storage;
         _path = path;
     }
 
-    // установить таймаут записи, мс (умолч. 10000)
+    // записать на носитель данные, отложенные хранилищем (групповая синхронизация PosixStorage)
+    bool sync() {
+        return _st && _st->sync();
+    }
+
+    // установить таймаут записи, мс (умолч. 10000). Максимальное время от первого несохранённого изменения до записи
     void setTimeout(uint32_t tout = 10000) {
         _tout = tout;
     }
 
+    // записать, если изменений не было в течение idle мс (умолч. 0 - выкл)
+    void setIdle(uint32_t idle) {
+        _idle = idle;
+    }
+
+    // записать, когда накопится changes изменений или bytes байт изменённых ячеек (умолч. 0 - выкл)
+    void setDirtyLimit(uint16_t changes, uint32_t bytes = 0) {
+        _dirtyMax = changes;
+        _dirtyBytesMax = bytes;
+    }
+
+    // ограничить количество записей в час для защиты флешки (умолч. 0 - без ограничения).
+    // Запись по таймеру откладывается до появления свободной записи в лимите
+    void setWriteBudget(uint16_t perHour) {
+        _perHour = perHour;
+        _tokens = perHour;
+        _bucketTmr = millis();
+    }
+
+    // критичная ячейка: её изменение записывается при следующем tick() без ожидания и лимитов
+    void setCritical(size_t hash, bool critical = true) {
+        hash &= DB_HASH_MASK;
+        for (size_t i = 0; i < _critical.length(); i++) {
+            if (_critical[i] == hash) {
+                if (!critical) _critical.remove(i);
+                return;
+            }
+        }
+        if (critical) _critical.push(hash);
+    }
+    void setCritical(const Text& key, bool critical = true) {
+        setCritical(key.hash(), critical);
+    }
+
+    // запись по частям в tick(): не больше entries ячеек и bytes байт за вызов, чтобы не блокировать loop.
+    // Пишется снимок БД на момент начала записи, файл заменяется после записи последней части (умолч. 0 - выкл, запись целиком)
+    void setChunk(uint16_t entries, uint16_t bytes = 0) {
+        _chunkN = entries;
+        _chunkBytes = bytes;
+    }
+
+#ifdef DB_USE_PTHREAD
+    // фоновая запись: update() копирует БД в буфер в памяти, файл записывается в отдельном потоке.
+    // Изменения во время записи попадут в следующий буфер (умолч. выкл). Вернёт false, если поток не запустился
+    bool useAsync(bool use) {
+        if (!use) {
+            _async.end();
+            _asyncDone();
+        } else if (!_async.begin(_asyncWrite, this)) {
+            return false;
+        }
+        _asyncOn = use;
+        return true;
+    }
+
+    // дождаться окончания фоновой записи
+    void waitSave() {
+        _async.wait();
+        _asyncDone();
+    }
+#endif
+
+    // подключить обработчик окончания фоновой записи и записи по частям, вызывается в tick()
+    void onSave(SaveCallback cb) {
+        _save_cb = cb;
+    }
+
+    // идёт запись по частям или фоновая запись
+    bool saving() {
+#ifdef DB_USE_PTHREAD
+        if (_async.busy()) return true;
+#endif
+        return _job.valid();
+    }
+
+    // количество записей в файл
+    uint32_t flushCount() {
+        return _flushes;
+    }
+
+    // количество изменений, сохранённых без отдельной записи (объединены с другими)
+    uint32_t flushAvoided() {
+        return _avoided;
+    }
+
+    // количество записей, отложенных из-за лимита в час
+    uint32_t flushDeferred() {
+        return _deferred;
+    }
+
+#ifndef DB_NO_UPDATES
+    // режим журнала: при обновлении изменённые ячейки дописываются в файл журнала (путь + ".log"),
+    // файл БД перезаписывается целиком, когда журнал больше ratio размеров БД (умолч. выкл). Вызывать до begin()
+    void useLog(bool use, uint8_t ratio = 2) {
+        _useLog = use;
+        _ratio = ratio ? ratio : 1;
+        if (use) _cursor = cursor();
+    }
+#endif
+
+    // режим слотов: БД записывается по очереди в n файлов (путь + ".0" ... ".n-1") с заголовком (номер записи, размер, CRC32).
+    // При чтении выбирается новейший целый слот - обрыв записи не портит предыдущую копию (умолч. 0 - выкл). Вызывать до begin()
+    void useSlots(uint8_t n) {
+        _slots = n;
+        _slot = n ? n - 1 : 0;
+        _seq = 0;
+    }
+
+    // ленивое чтение: begin() читает только ключи, данные строк и бинарных ячеек читаются из файла при первом обращении
+    // и хранятся в памяти в пределах budget байт: давно не использованные вытесняются в tick() и update(), поэтому Entry таких
+    // ячеек действительны до их вызова (умолч. 0 - выкл). Вызывать до begin().
+    // Файл пишется в обычном (не компактном) формате, компактный файл читается целиком
+    void useLazy(size_t budget) {
+        _lazyBudget = budget;
+        _watchGet = budget || _blobMin;
+        if (!budget) _lazyReset();
+    }
+
+    // объём данных, прочитанных в ленивом режиме и находящихся в памяти
+    size_t lazyUsage() {
+        return _lazyRam;
+    }
+
+    // блобы: строки и бинарные данные от threshold байт хранятся в отдельных файлах (путь + ".b" + номер), в образе БД
+    // остаётся ссылка (номер, размер, CRC32). Файл блоба пишется только при изменении ячейки. Данные читаются при обращении
+    // и хранятся в памяти в пределах budget байт, давно не использованные вытесняются в tick() и update() (умолч. 0 - выкл).
+    // writeTo() пишет в образ сами данные. Ключ DB_BLOB_KEY занят индексом блобов. Вызывать до begin()
+    void useBlobs(uint16_t threshold, size_t budget = 4096) {
+        if (!threshold) _blobRelease();
+        _blobMin = threshold;
+        _blobBudget = budget;
+        _watchGet = threshold || _lazyBudget;
+    }
+
+    // объём данных блобов, находящихся в памяти
+    size_t blobUsage() {
+        return _blobRam;
+    }
+
+    // прочитать часть данных строки или бинарной ячейки, не загружая её целиком (блоб, ленивый режим).
+    // Вернёт количество прочитанных байт
+    size_t readBlob(size_t hash, size_t offset, void* buf, size_t len) {
+        int idx = indexOf(hash);
+        if (idx < 0) return 0;
+        const gdb::block_t& b = _buf[idx];
+        if (b.type() != gdb::Type::String && b.type() != gdb::Type::Bin) return 0;
+        blob_t* bl = _blobs.get(b.keyHash());
+        lazy_t* l = bl ? nullptr : _cold(b);
+        size_t size = bl ? bl->size : (l ? l->size : b.size());
+        if (offset >= size) return 0;
+        if (len > size - offset) len = size - offset;
+        if (b.ptr()) {
+            memcpy(buf, (uint8_t*)b.buffer() + offset, len);
+            return len;
+        }
+        gdb::DBFile file = bl ? _open(_blobPath(bl->id).c_str(), "r") : _open(_lazySrc.c_str(), "r");
+        if (!file || !file.seek(bl ? offset : _lazyBase + l->offset + offset)) return 0;
+        return file.read((uint8_t*)buf, len);
+    }
+    size_t readBlob(const Text& key, size_t offset, void* buf, size_t len) {
+        return readBlob(key.hash(), offset, buf, len);
+    }
+
+    // номер последней записанной (прочитанной) копии в режиме слотов
+    uint32_t slotSeq() {
+#ifdef DB_USE_PTHREAD
+        _async.wait();
+#endif
+        return _seq;
+    }
+
     // прочитать данные
     bool begin() {
         bool res = false;
-        if (_fs) {
-            if (_fs->exists(_path)) {
-                File file = _fs->open(_path, "r");
-                if (file) res = readFrom(file, file.size());
+        if (_st) {
+            if (_exists()) {
+                res = loadInto(*this);
                 _update = false;
             } else {
-                File file = _fs->open(_path, "w");
+                if (!_slots) _open(_path, "w");
+                _dbSize = 0;
                 res = true;
             }
         }
+        _skipChanges();
         return res;
     }
 
-    // обновить данные в файле, если было изменение БД. Вернёт true при успешной записи
-    bool update() {
-        _tmr = 0;
-        if (!_update) return false;
+    // начать поэтапное чтение: tick() загружает по chunk записей за вызов, прочитанные ячейки сразу доступны.
+    // Изменения БД во время загрузки сохраняются и не перезаписываются данными из файла. Вернёт false при ошибке открытия
+    bool beginAsync(uint16_t chunk = 16) {
+        if (!_st) return false;
+#ifdef DB_USE_PTHREAD
+        _async.wait();
+#endif
+        clear();
         _update = false;
-        File file = _fs->open(_path, "w");
-        return file ? writeTo(file) : 0;
+        _loadChunk = chunk ? chunk : 1;
+        _loadOk = false;
+        _loadCrc = false;
+        // ленивое чтение и так читает только ключи
+        if (!_exists() || _watchGet) return _loadOk = begin();
+
+        slot_t h;
+        int16_t slot = _slots ? _newestSlot(h, nullptr) : -1;
+        if (slot >= 0) {
+            _loadFile = _open(_slotPath(slot).c_str(), "r");
+            if (!_loadFile) return false;
+            _loadFile.seek(sizeof(slot_t));
+            _loadLeft = h.len;
+            _loadCrc = true;
+            _loadSlotH = h;
+            _seq = h.seq;
+            _slot = slot;
+        } else {
+            if (!_st->exists(_path)) return false;
+            _loadFile = _open(_path, "r");
+            if (!_loadFile) return false;
+            _loadLeft = _loadFile.size();
+        }
+        _dbSize = _loadLeft;
+        _loadStream = gdb::BufStream(_loadFile);
+
+        Reader reader(_loadStream, _loadLeft);
+        if (!_loadImg.begin(reader)) return _loadEnd(false);
+        reserve(_loadImg.len);
+        _loadLeft = reader.available();
+        _loading = 1;
+        return true;
     }
 
-    // тикер, вызывать в loop. Сам обновит данные при изменении и выходе таймаута, вернёт true
+    // идёт поэтапная загрузка
+    bool loading() {
+        return _loading;
+    }
+
+    // поэтапная загрузка завершена успешно
+    bool loaded() {
+        return !_loading && _loadOk;
+    }
+
+    // прочитать файл (и журнал) в другую БД (напр. временную для проверки перед заменой)
+    bool loadInto(GyverDB& db) {
+        return _loadInto(db, true);
+    }
+
+    // перечитать файл без остановки работы: данные загружаются во временную БД с теми же режимами и заменяются за O(1)
+    // только при успешном чтении. Незагруженные данные (ленивое чтение, блобы) остаются в файлах.
+    // Обработчики получат только изменившиеся ячейки
+    bool reload() {
+        _abortSave();
+#ifdef DB_USE_PTHREAD
+        _async.wait();
+#endif
+        GyverDBFile db(_st, _path);
+        db.useSlots(_slots);
+        db.useLazy(_lazyBudget);
+        db.useBlobs(_blobMin, _blobBudget);
+        db._blobSeq = _blobSeq;
+        db._blobGen = _blobGen;
+#ifndef DB_NO_UPDATES
+        db.useLog(_useLog, _ratio);
+#endif
+        bool ok = db._loadInto(db, true);
+        if (ok) _install(db);
+        // временная БД не пишет файл
+        db._update = false;
+        return ok;
+    }
+
+    // обновить данные в файле, если было изменение БД. Вернёт true при успешной записи (в фоновом режиме - при передаче буфера потоку).
+    // Незаконченная запись по частям дописывается целиком
+    bool update() {
+        _finishLoad();
+        _finishSave();
+        bool ok = _flush(false);
+        _trim();
+        return ok;
+    }
+
+    // тикер, вызывать в loop. Сам обновит данные при изменении и выполнении условий записи, вернёт true
     bool tick() {
-        if (_update && !_tmr) {
-            _tmr = millis();
+        GyverDB::tick();
+        _trim();
+        if (_st) _st->tick();
+#ifdef DB_USE_PTHREAD
+        _asyncDone();
+#endif
+        if (_loading) {
+            _loadStep();
+            return 0;
         }
-        if (_tmr && millis() - _tmr >= _tout) {
-            update();
-            return 1;
+        if (_job.valid()) {
+            bool ok = _saveStep();
+            if (_job.valid()) return 0;
+            if (_save_cb) _save_cb(ok);
+            return ok;
+        }
+        if (!_update) return 0;
+        uint32_t now = millis();
+        if (!_tmr) _tmr = now;
+
+        bool due = _force ||
+                   now - _tmr >= _tout ||
+                   (_idle && now - _last >= _idle) ||
+                   (_dirtyMax && _dirty >= _dirtyMax) ||
+                   (_dirtyBytesMax && _dirtyBytes >= _dirtyBytesMax);
+        if (!due) return 0;
+
+        if (!_force && !_takeToken(now)) {
+            if (!_limited) _deferred++;
+            _limited = true;
+            return 0;
+        }
+        _flush(_chunkN || _chunkBytes);
+        return !_job.valid();
+    }
+
+   protected:
+    // экспортный размер: в ленивом режиме учитывает незагруженные данные, блобы в своём файле - ссылками
+    size_t _exportSize() override {
+        size_t sz = gdb::imageSize(nullptr, 0);
+        if (_fileImage && (_blobs.length() || _blobTrash.length())) sz += gdb::dynamicSize(_blobIndexSize(), DB_IMAGE_VER);
+        for (size_t i = 0; i < _len; i++) {
+            const gdb::block_t& b = _buf[i];
+            blob_t* bl = _blobs.get(b.keyHash());
+            if (bl && _fileImage) continue;
+            if (bl && !b.ptr()) {
+                sz += gdb::dynamicSize(bl->size, DB_IMAGE_VER);
+                continue;
+            }
+            lazy_t* l = _cold(b);
+            sz += l ? gdb::dynamicSize(l->size, DB_IMAGE_VER) : gdb::recordSize(b.type(), b.buffer(), b.size(), DB_IMAGE_VER);
+        }
+        return sz;
+    }
+
+    // образ для writeTo: в ленивом режиме незагруженные данные копируются из файла. В свой файл вместо блобов пишется
+    // индекс ссылок на их файлы, в остальные образы - данные блобов
+    bool _export(gdb::Sink& sink) override {
+        gdb::DBFile src;
+        gdb::BufWriter buf(sink);
+        gdb::ImageWriter<gdb::BufWriter> img(buf);
+        size_t nblobs = _blobs.length();
+        bool index = !_fileImage || (!nblobs && !_blobTrash.length());
+        img.begin(_len - (_fileImage ? nblobs : 0) + !index);
+        for (size_t i = 0; i <= _len; i++) {
+            // индекс - на своём месте в порядке хэшей
+            if (!index && (i == _len || _buf[i].keyHash() > DB_BLOB_KEY)) {
+                index = true;
+                if (!_blobIndexWrite(img)) return false;
+            }
+            if (i == _len) break;
+            const gdb::block_t& b = _buf[i];
+            blob_t* bl = nblobs ? _blobs.get(b.keyHash()) : nullptr;
+            if (bl && _fileImage) continue;
+            if (bl && !b.ptr()) {
+                if (!_blobCopy(img, b, *bl)) return false;
+                continue;
+            }
+            lazy_t* l = _lazy.get(b.keyHash());
+            if (!l || !_cold(b)) {
+                if (l) l->next = img.written + gdb::dynamicSize(0, DB_IMAGE_VER);  // положение данных в новом образе
+                img.record(b);
+                continue;
+            }
+            if (!src) src = _open(_lazySrc.c_str(), "r");
+            if (!src || !src.seek(_lazyBase + l->offset)) return false;
+            img.head(b.typehash, l->size);
+            l->next = img.written;
+            uint8_t chunk[32];
+            size_t left = l->size;
+            while (left) {
+                size_t n = src.read(chunk, left < sizeof(chunk) ? left : sizeof(chunk));
+                if (!n) return false;
+                img.data(chunk, n);
+                left -= n;
+            }
+        }
+        bool ok = img.end();
+        return buf.flush() && ok;
+    }
+
+    // загрузить данные ячейки из файла при первом обращении. Данные остаются в памяти до tick() или update()
+    void _fetch(gdb::block_t& b) override {
+        if (_blobs.length() && _blobFetch(b)) return;
+        lazy_t* l = _lazy.get(b.keyHash());
+        if (!l) return;
+        if (l->used) {
+            l->used = ++_lazyTick;
+            return;
+        }
+        if (b.ptr()) return;
+        gdb::DBFile file = _open(_lazySrc.c_str(), "r");
+        if (!file || !file.seek(_lazyBase + l->offset) || !b.reserve(l->size)) return;
+        if (file.read((uint8_t*)b.buffer(), l->size) != l->size) {
+            free(b.ptr());
+            b.data = 0;
+            return;
+        }
+        b.setSize(l->size);
+        l->used = ++_lazyTick;
+        _lazyRam += l->size;
+    }
+
+    // ячейки заменены обменом: все данные теперь в памяти, ссылки на файл устарели - образ пишется заново
+    void _onSwap() override {
+        _lazyReset();
+        _blobs.forEach([this](size_t, blob_t& bl) { _blobTrash.push(trash_t{bl.id, _blobGen}); });
+        if (_blobs.length()) _blobIndex = true;
+        _blobReset();
+        _update = true;
+#ifndef DB_NO_UPDATES
+        _fullSave = true;  // обменянных ячеек нет в журнале
+#endif
+    }
+
+    // ячейка может быть ещё не загружена - запоминаем, чтобы не восстановить её из файла
+    void _onRemoveMissing(size_t hash) override {
+        if (_loading && !_replaying) _touched.put(hash, 1);
+    }
+
+    void _onChange(size_t hash) override {
+        if (_loading && !_replaying) _touched.put(hash, 1);
+        if (_watchGet && !_installing) {
+            _lazyDrop(hash);
+            _blobDrop(hash);
+        }
+        _last = millis();
+        if (!_tmr) _tmr = _last;
+        _dirty++;
+        int idx = indexOf(hash);
+        _dirtyBytes += (idx >= 0) ? gdb::recordSize(_buf[idx].type(), _buf[idx].buffer(), _buf[idx].size()) : 8;
+
+        hash &= DB_HASH_MASK;
+        for (size_t i = 0; i < _critical.length(); i++) {
+            if (_critical[i] == hash) _force = true;
         }
-        return 0;
     }
 
    private:
-    fs::FS* _fs;
-    const char* _path;
+    struct lazy_t {
+        uint32_t offset;  // положение данных в образе
+        uint32_t next;    // положение данных в записываемом образе
+        uint32_t used;    // время последнего обращения, 0 - не загружена
+        uint32_t crc;     // CRC32 данных
+        uint16_t size;
+    };
+
+    struct blob_t {
+        uint32_t id;    // номер файла блоба
+        uint32_t crc;   // CRC32 данных
+        uint32_t used;  // время последнего обращения, 0 - не загружен
+        uint16_t size;
+    };
+
+    // ссылка на блоб в индексе образа
+    struct blobref_t {
+        uint32_t typehash, id, size, crc;
+    };
+
+    // устаревший файл блоба и номер записи образа, после которой он устарел
+    struct trash_t {
+        uint32_t id, gen;
+    };
+
+    struct slot_t {
+        uint32_t magic;
+        uint32_t seq;
+        uint32_t len;
+        uint32_t crc;
+    };
+
+    gdb::Storage* _st = nullptr;
+#ifdef DB_USE_FS
+    gdb::FSStorage _fsStorage;
+#endif
+    const char* _path = nullptr;
     uint32_t _tmr = 0, _tout = 10000;
+    uint32_t _idle = 0, _last = 0;
+    uint16_t _dirtyMax = 0, _dirty = 0;
+    uint32_t _dirtyBytesMax = 0, _dirtyBytes = 0;
+    uint16_t _perHour = 0, _tokens = 0;
+    uint32_t _bucketTmr = 0;
+    uint32_t _flushes = 0, _avoided = 0, _deferred = 0;
+    gtl::stack<uint32_t> _critical;
+    uint16_t _chunkN = 0, _chunkBytes = 0;
+    // приёмник записи по частям: образ пишется через буфер в файл с подсчётом CRC. Живёт, пока идёт запись
+    struct job_t {
+        job_t(gdb::DBFile* file) : crc(file), sink(crc), buf(sink), img(buf) {}
+
+        gdb::CrcPrint crc;
+        gdb::WriterSink<gdb::CrcPrint> sink;
+        gdb::BufWriter buf;
+        gdb::ImageWriter<gdb::BufWriter> img;
+    };
+
+    gdb::Snapshot _job;
+    gdb::DBFile _jobFile;
+    job_t* _jobOut = nullptr;
+    size_t _jobIdx = 0;
+    bool _jobCompact = false;
+    gdb::DBFile _loadFile;
+    gdb::BufStream _loadStream;
+    gdb::ImageReader _loadImg;
+    gdb::HashMap<uint8_t> _touched;  // ячейки, изменённые во время загрузки
+    slot_t _loadSlotH;
+    size_t _loadLeft = 0;
+    uint16_t _loadChunk = 16;
+    uint8_t _loading = 0;  // 1 - образ, 2 - журнал
+    bool _loadOk = false, _loadCrc = false, _replaying = false, _fullSave = false;
+    gdb::HashMap<lazy_t> _lazy;  // ячейки, данные которых можно прочитать из файла
+    String _lazySrc;
+    size_t _lazyBase = 0, _lazyBudget = 0, _lazyRam = 0;
+    uint32_t _lazyTick = 0;
+    gdb::HashMap<blob_t> _blobs;  // ячейки, данные которых в файлах блобов
+    gtl::stack<trash_t> _blobTrash;
+    size_t _blobBudget = 0, _blobRam = 0;
+    uint32_t _blobSeq = 0, _blobGen = 0;
+    uint16_t _blobMin = 0;
+    bool _blobIndex = false;  // индекс блобов изменился с последней записи
+    bool _fileImage = false;  // идёт запись образа в свой файл
+    bool _installing = false;  // замена данных перечитанными из файла - ссылки на файл уже новые
+    SaveCallback _save_cb = nullptr;
+#ifdef DB_USE_PTHREAD
+    gdb::AsyncWriter _async;
+    bool _asyncOn = false, _asyncLog = false;
+#endif
+    bool _force = false, _limited = false;
+    size_t _dbSize = 0;
+    uint32_t _seq = 0;
+    uint8_t _slots = 0, _slot = 0;
+#ifndef DB_NO_UPDATES
+    Cursor _cursor;
+    size_t _logSize = 0;
+    uint8_t _ratio = 2;
+    bool _useLog = false;
+#endif
+
+    void _moveFile(GyverDBFile& db) {
+        _finishLoad();
+        db._finishLoad();
+        _finishSave();
+        db._finishSave();
+#ifdef DB_USE_PTHREAD
+        // поток привязан к объекту - перезапускаем
+        _async.end();
+        db._async.end();
+        _asyncDone();
+        db._asyncDone();
+        gtl::swap(_asyncOn, db._asyncOn);
+        if (_asyncOn) _async.begin(_asyncWrite, this);
+        if (db._asyncOn) db._async.begin(_asyncWrite, &db);
+#endif
+        gtl::swap(_save_cb, db._save_cb);
+        gtl::swap(_fullSave, db._fullSave);
+        _lazy.swap(db._lazy);
+        gtl::swap(_lazySrc, db._lazySrc);
+        gtl::swap(_lazyBase, db._lazyBase);
+        gtl::swap(_lazyBudget, db._lazyBudget);
+        gtl::swap(_lazyRam, db._lazyRam);
+        gtl::swap(_lazyTick, db._lazyTick);
+        gtl::swap(_watchGet, db._watchGet);
+        _blobs.swap(db._blobs);
+        gtl::stack<trash_t> trash;
+        trash.move(_blobTrash);
+        _blobTrash.move(db._blobTrash);
+        db._blobTrash.move(trash);
+        gtl::swap(_blobBudget, db._blobBudget);
+        gtl::swap(_blobRam, db._blobRam);
+        gtl::swap(_blobSeq, db._blobSeq);
+        gtl::swap(_blobGen, db._blobGen);
+        gtl::swap(_blobMin, db._blobMin);
+        gtl::swap(_blobIndex, db._blobIndex);
+        gtl::swap(_st, db._st);
+#ifdef DB_USE_FS
+        // встроенное хранилище ФС переезжает вместе с указателем на него
+        gtl::swap(_fsStorage, db._fsStorage);
+        if (_st == &db._fsStorage) _st = &_fsStorage;
+        if (db._st == &_fsStorage) db._st = &db._fsStorage;
+#endif
+        gtl::swap(_path, db._path);
+        gtl::swap(_tmr, db._tmr);
+        gtl::swap(_tout, db._tout);
+        gtl::swap(_dbSize, db._dbSize);
+        gtl::swap(_idle, db._idle);
+        gtl::swap(_last, db._last);
+        gtl::swap(_dirtyMax, db._dirtyMax);
+        gtl::swap(_dirty, db._dirty);
+        gtl::swap(_dirtyBytesMax, db._dirtyBytesMax);
+        gtl::swap(_dirtyBytes, db._dirtyBytes);
+        gtl::swap(_perHour, db._perHour);
+        gtl::swap(_tokens, db._tokens);
+        gtl::swap(_bucketTmr, db._bucketTmr);
+        gtl::swap(_flushes, db._flushes);
+        gtl::swap(_avoided, db._avoided);
+        gtl::swap(_deferred, db._deferred);
+        gtl::stack<uint32_t> crit;
+        crit.move(_critical);
+        _critical.move(db._critical);
+        db._critical.move(crit);
+        gtl::swap(_chunkN, db._chunkN);
+        gtl::swap(_chunkBytes, db._chunkBytes);
+        gtl::swap(_force, db._force);
+        gtl::swap(_limited, db._limited);
+        gtl::swap(_seq, db._seq);
+        gtl::swap(_slots, db._slots);
+        gtl::swap(_slot, db._slot);
+#ifndef DB_NO_UPDATES
+        uint32_t pos = _cursor.position();
+        _cursor = Cursor(this, db._cursor.position());
+        db._cursor = Cursor(&db, pos);
+        gtl::swap(_logSize, db._logSize);
+        gtl::swap(_ratio, db._ratio);
+        gtl::swap(_useLog, db._useLog);
+#endif
+    }
+
+    // записать изменения: журнал или файл БД, целиком или начать запись по частям
+    bool _flush(bool chunked) {
+        _tmr = 0;
+        _force = _limited = false;
+        if (_dirty) _avoided += _dirty - 1;
+        _dirty = _dirtyBytes = 0;
+        if (!_update || !_st) return false;
+#ifdef DB_USE_PTHREAD
+        // идёт фоновое сжатие журнала - журнал дописывается после его окончания
+        if (_asyncLog) return false;
+#endif
+        _update = false;
+        _flushes++;
+        _blobStore();
+#ifndef DB_NO_UPDATES
+        if (_useLog) {
+            if (!_cursor.lost() && !_fullSave) {
+                // журнал дописывается всегда: если сжатие прервётся, журнал поверх нового файла даст то же состояние
+                bool ok = _appendLog();
+                if (ok && _logSize <= _dbSize * _ratio) return true;
+            }
+            return _compact(chunked);
+        }
+#endif
+        // в ленивом режиме снимок и буфер не содержат незагруженных данных - только запись целиком
+#ifdef DB_USE_PTHREAD
+        if (_asyncOn && !_watchGet) return _writeAsync(false);
+#endif
+        if (chunked && !_watchGet && _startSave(false)) return true;
+        return _writeDB();
+    }
+
+#ifdef DB_USE_PTHREAD
+    // скопировать БД в буфер и отдать потоку записи. При нехватке памяти - запись целиком здесь
+    bool _writeAsync(bool compact) {
+        size_t len = writeSize();
+        if (_async.write(len, [this](uint8_t* buf) { writeTo(buf); })) {
+            _asyncLog = compact;
+            return true;
+        }
+        waitSave();
+        return _writeDB();
+    }
+
+    // запись в потоке. Переменные слотов и размер БД меняет только поток, пока он работает
+    static bool _asyncWrite(void* ctx, const uint8_t* buf, size_t len) {
+        return ((GyverDBFile*)ctx)->_writeBuf(buf, len);
+    }
+
+    // обработать окончание фоновой записи
+    void _asyncDone() {
+        bool ok;
+        if (!_async.done(ok)) return;
+#ifndef DB_NO_UPDATES
+        if (_asyncLog && ok) {
+            _st->remove(_logPath().c_str());
+            _logSize = 0;
+        }
+#endif
+        _asyncLog = false;
+        if (!ok) _update = true;
+        if (_save_cb) _save_cb(ok);
+    }
+#endif
+
+    // записать образ из буфера: в следующий слот или через временный файл
+    bool _writeBuf(const uint8_t* buf, size_t len) {
+        if (_slots) {
+            slot_t h{DB_SLOT_MAGIC, _seq + 1, (uint32_t)len, gdb::crc32(0, buf, len)};
+            uint8_t slot = (_slot + 1) % _slots;
+            gdb::DBFile file = _open(_slotPath(slot).c_str(), "w");
+            if (!file) return false;
+            if (file.write((uint8_t*)&h, sizeof(h)) != sizeof(h) || file.write(buf, len) != len) return false;
+            if (!file.close()) return false;
+            _seq = h.seq;
+            _slot = slot;
+        } else {
+            String tmp = String(_path) + ".tmp";
+            gdb::DBFile file = _open(tmp.c_str(), "w");
+            if (!file) return false;
+            if (file.write(buf, len) != len || !file.close()) return false;
+            if (!_replaceFile(tmp)) return false;
+        }
+        _dbSize = len;
+        return true;
+    }
+
+    // заменить файл БД временным
+    bool _replaceFile(const String& tmp) {
+        if (_st->rename(tmp.c_str(), _path)) return true;
+        // не все ФС заменяют существующий файл при переименовании
+        _st->remove(_path);
+        return _st->rename(tmp.c_str(), _path);
+    }
+
+    // начать запись по частям из снимка БД. В режиме слотов пишется сразу в следующий слот, иначе во временный файл
+    bool _startSave(bool compact) {
+        _job = snapshot();
+        if (!_job.valid()) return false;
+        String path = _slots ? _slotPath((_slot + 1) % _slots) : (String(_path) + ".tmp");
+        _jobFile = _open(path.c_str(), "w");
+        if (!_jobFile) {
+            _job.release();
+            return false;
+        }
+        _jobIdx = 0;
+        _jobCompact = compact;
+        if (_slots) {
+            // размер и CRC дописываются в заголовок в конце: до этого слот не пройдёт проверку
+            slot_t h{DB_SLOT_MAGIC, _seq + 1, 0, 0};
+            _jobFile.write((uint8_t*)&h, sizeof(h));
+        }
+        _jobOut = new job_t(&_jobFile);
+        if (!_jobOut) {
+            _abortSave();
+            return false;
+        }
+        _jobOut->img.begin(_job.length(), true, _imgMode);
+        if (_jobOut->buf.flush()) return true;
+        _abortSave();
+        return false;
+    }
+
+    // записать следующую часть. Вернёт false при ошибке записи
+    bool _saveStep() {
+        // часть собирается в буфер и пишется в файл блоками, остаток буфера - в конце части
+        gdb::ImageWriter<gdb::BufWriter>& img = _jobOut->img;
+        size_t n = 0, start = img.written, len = _job.length();
+        bool ok = true;
+        while (ok && _jobIdx < len) {
+            if (_chunkN && n >= _chunkN) break;
+            if (_chunkBytes && img.written - start >= _chunkBytes) break;
+            gdb::Entry e = _job.getN(_jobIdx++);
+            ok = img.record(e.type(), e.keyHash(), e.buffer(), e.size());
+            n++;
+        }
+        if (ok && _jobIdx >= len) ok = img.end();
+        if (!_jobOut->buf.flush() || !ok) {
+            _abortSave();
+            return false;
+        }
+        if (_jobIdx < len) return true;
+        return _endSave();
+    }
+
+    // завершить запись по частям: заменить файл
+    bool _endSave() {
+        bool ok = true;
+        size_t size = _jobOut->crc.len;
+        uint32_t crc = _jobOut->crc.crc;
+        _jobRelease();
+        if (_slots) {
+            uint32_t tail[2] = {(uint32_t)size, crc};
+            _jobFile.seek(offsetof(slot_t, len));
+            ok = _jobFile.write((uint8_t*)tail, 8) == 8;
+            ok = _jobFile.close() && ok;
+            if (ok) {
+                _seq++;
+                _slot = (_slot + 1) % _slots;
+            }
+        } else {
+            ok = _jobFile.close() && _replaceFile(String(_path) + ".tmp");
+        }
+        if (ok) {
+            _dbSize = size;
+#ifndef DB_NO_UPDATES
+            if (_jobCompact) {
+                _st->remove(_logPath().c_str());
+                _logSize = 0;
+            }
+#endif
+        } else {
+            _update = true;
+        }
+        _job.release();
+        return ok;
+    }
+
+    // отменить запись по частям. Изменения будут записаны снова
+    void _abortSave() {
+        if (!_job.valid()) return;
+        _jobRelease();
+        _jobFile.close();
+        if (!_slots) _st->remove((String(_path) + ".tmp").c_str());
+        _job.release();
+        _update = true;
+    }
+
+    // освободить приёмник записи по частям. Записанное в файл остаётся
+    void _jobRelease() {
+        delete _jobOut;
+        _jobOut = nullptr;
+    }
+
+    // дописать запись по частям целиком
+    void _finishSave() {
+        uint16_t n = _chunkN, b = _chunkBytes;
+        _chunkN = _chunkBytes = 0;
+        if (_job.valid()) _saveStep();
+        _chunkN = n;
+        _chunkBytes = b;
+    }
+
+    // загрузить следующую часть: ячейки образа, затем журнал
+    void _loadStep() {
+        Reader reader(_loadStream, _loadLeft);
+        for (uint16_t n = 0; n < _loadChunk && (_loading == 1 ? _loadImg.available(reader) : reader.available()); n++) {
+            gdb::block_t block;
+            if (!(_loading == 1 ? _loadImg.next(reader, block) : gdb::readRecord(reader, block))) {
+                // обрыв в конце журнала - применяем всё до него, как при обычном чтении
+                if (_loading == 2) _fullSave = true;
+                _loadEnd(_loading == 2);
+                return;
+            }
+            size_t hash = block.keyHash();
+            if (_touched.has(hash)) {
+                block.reset();
+                continue;
+            }
+            if (_loading == 1) {
+                if (!_load(block)) {
+                    _loadEnd(false);
+                    return;
+                }
+            } else {
+                _replaying = true;
+                bool ok = true;
+                if (block.type() == gdb::Type::None) remove(hash);
+                else ok = _replace(block);
+                _replaying = false;
+                if (!ok) {
+                    _loadEnd(false);
+                    return;
+                }
+            }
+        }
+        if (_loading == 1 ? _loadImg.available(reader) : reader.available()) {
+            _loadLeft = reader.available();
+            return;
+        }
+
+        if (_loading == 2) {
+            _loadEnd(true);
+            return;
+        }
+        bool ok = _loadImg.end(reader);
+        if (!ok && !_slots) {
+            _loadEnd(false);
+            return;
+        }
+        // CRC слота считается по прочитанным блокам - дочитываем остаток
+        uint8_t rest;
+        while (reader.read(rest));
+        if (!ok || (_loadCrc && _loadStream.crc != _loadSlotH.crc)) {
+            // слот повреждён - читаем целиком с выбором предыдущего слота. Изменения во время загрузки теряются
+            _loadFile.close();
+            _loading = 0;
+            _touched.reset();
+            _loadOk = begin();
+            return;
+        }
+        _loadFile.close();
+#ifndef DB_NO_UPDATES
+        _logSize = 0;
+        String path = _logPath();
+        if (_useLog && _st->exists(path.c_str())) {
+            _loadFile = _open(path.c_str(), "r");
+            if (_loadFile) {
+                _loadLeft = _logSize = _loadFile.size();
+                _loadStream = gdb::BufStream(_loadFile);
+                _loadCrc = false;
+                _loading = 2;
+                return;
+            }
+        }
+#endif
+        _loadEnd(true);
+    }
+
+    // закончить поэтапную загрузку
+    bool _loadEnd(bool ok) {
+        _loadFile.close();
+        _loadStream = gdb::BufStream();
+        _loading = 0;
+        _loadOk = ok;
+        // если во время загрузки БД не менялась - она совпадает с файлом
+        if (!_touched.length()) {
+            _skipChanges();
+            _update = false;
+        } else {
+            // удаление ещё не загруженной ячейки не попало в курсор - журнала недостаточно
+            _update = true;
+            _fullSave = true;
+        }
+        _touched.reset();
+        return ok;
+    }
+
+    // дочитать поэтапную загрузку целиком
+    void _finishLoad() {
+        uint16_t n = _loadChunk;
+        _loadChunk = 0xffff;
+        while (_loading) _loadStep();
+        _loadChunk = n;
+    }
+
+    // прочитать образ в БД. В ленивом режиме в себя читаются только ключи, для строк и бинарных - положение данных в файле.
+    // Данные строк читаются только для CRC образа и в памяти не остаются
+    bool _readImage(gdb::DBFile& file, size_t len, GyverDB& db, const String& path, size_t base) {
+        if (!_lazyBudget || &db != this) return db.readFrom((gdb::Source&)file, len);
+        clear();
+        _lazyReset();
+        _lazySrc = path;
+        _lazyBase = base;
+        if (_readIndex(file, len, base)) return 1;
+        // незагруженные ячейки повреждённого образа не должны читаться из него позже
+        clear();
+        _lazyReset();
+        return 0;
+    }
+
+    // прочитать ключи образа и положение данных строк и бинарных ячеек с проверкой CRC
+    bool _readIndex(gdb::DBFile& file, size_t len, size_t base) {
+        uint8_t head[sizeof(gdb::image_t)], ver, flags;
+        uint32_t n, crc = 0;
+        size_t off = gdb::imageHeader(head, file.read(head, len < sizeof(head) ? len : sizeof(head)), ver, flags, n);
+        if (!off) return 0;
+        if (flags & (DB_IMAGE_COMPACT | DB_IMAGE_SEGMENTS | DB_IMAGE_DELTA) || !(flags & DB_IMAGE_SORTED)) {
+            // положение данных в компактном и сегментированном образе не сохраняется - читается целиком
+            return file.seek(base) && readFrom((gdb::Source&)file, len);
+        }
+        if (!file.seek(base + off)) return 0;
+        if (ver >= 2) {
+            if (len < off + 4) return 0;
+            len -= 4;
+        }
+        reserve(n);
+        while (off < len) {
+            gdb::block_t b;
+            uint16_t size = 0;
+            if (!_readCrc(file, &b.typehash, 4, ver, crc)) return 0;
+            off += 4;
+            if (b.isDynamic()) {
+                uint16_t hi = 0;
+                // старшая половина размера зарезервирована: ячейки до 64 КБ
+                if (ver >= 2 && (!_readCrc(file, &hi, 2, ver, crc) || hi)) return 0;
+                if (!_readCrc(file, &size, 2, ver, crc)) return 0;
+                off += (ver >= 2) ? 4 : 2;
+            }
+            size_t hash = b.keyHash();
+            bool lazy = (b.type() == gdb::Type::String || b.type() == gdb::Type::Bin);
+            uint32_t dcrc = 0;
+            if (lazy) {
+                // данные читаются только для CRC образа и ячейки (сравнение при reload() без загрузки)
+                uint8_t buf[32];
+                for (uint16_t left = size; left;) {
+                    uint16_t k = left < sizeof(buf) ? left : sizeof(buf);
+                    if (!_readCrc(file, buf, k, ver, crc)) return 0;
+                    dcrc = gdb::crc32(dcrc, buf, k);
+                    left -= k;
+                }
+            } else if (b.isDynamic()) {
+                if (!b.reserve(size)) return 0;
+                if (!_readCrc(file, b.buffer(), size, ver, crc)) {
+                    b.reset();
+                    return 0;
+                }
+            } else {
+                uint32_t data;
+                if (!_readCrc(file, &data, 4, ver, crc)) return 0;
+                b.data = data;
+                size = 4;
+            }
+            // порядок ключей не проверяется заранее: запись не по порядку вставляется поиском
+            if (!_take(b, true)) return 0;
+            if (lazy && !_lazy.put(hash, lazy_t{(uint32_t)off, 0, 0, dcrc, size})) return 0;
+            off += size;
+        }
+        _takeEnd();
+        if (off != len) return 0;
+        if (ver < 2) return 1;
+        uint32_t c;
+        return file.read((uint8_t*)&c, 4) == 4 && c == crc;
+    }
+
+    // прочитать из файла с подсчётом CRC образа (у v1 нет)
+    static bool _readCrc(gdb::DBFile& file, void* buf, size_t len, uint8_t ver, uint32_t& crc) {
+        if (file.read((uint8_t*)buf, len) != len) return 0;
+        if (ver >= 2) crc = gdb::crc32(crc, buf, len);
+        return 1;
+    }
+
+    // прочитать файл и журнал в БД. blobs - применить индекс блобов
+    bool _loadInto(GyverDB& db, bool blobs) {
+        if (!_st) return false;
+#ifdef DB_USE_PTHREAD
+        _async.wait();
+#endif
+        if (&db == this) {
+            // список устаревших файлов - из прочитанного индекса: отменённые изменения могли снова ссылаться на них
+            _blobReset();
+            _blobTrash.reset();
+        }
+        if (_slots) {
+            int8_t res = _loadSlots(db);
+            if (res >= 0) return res && _replay(db) && (!blobs || _blobAttach(db));
+        }
+        // нет целых слотов - файл без слотов (напр. записанный до включения режима)
+        if (!_st->exists(_path)) return false;
+        gdb::DBFile file = _open(_path, "r");
+        if (!file) return false;
+        _dbSize = file.size();
+        if (!_readImage(file, _dbSize, db, _path, 0)) return false;
+        file.close();
+        return _replay(db) && (!blobs || _blobAttach(db));
+    }
+
+    // ячейка не загружена - её данные в файле
+    lazy_t* _cold(const gdb::block_t& b) {
+        if (b.ptr() || !b.isDynamic()) return nullptr;
+        return _lazy.get(b.keyHash());
+    }
+
+    // CRC32 и размер данных ячейки. У незагруженной - из ссылки на файл, без чтения
+    uint32_t _dataCrc(const gdb::block_t& b, size_t& size) {
+        blob_t* bl = b.ptr() ? nullptr : _blobs.get(b.keyHash());
+        lazy_t* l = bl ? nullptr : _cold(b);
+        if (bl || l) {
+            size = bl ? bl->size : l->size;
+            return bl ? bl->crc : l->crc;
+        }
+        size = b.size();
+        return gdb::crc32(0, b.buffer(), size);
+    }
+
+    // данные ячеек одного ключа совпадают: a - ячейка db, b - своя. Незагруженные сравниваются по размеру и CRC32
+    bool _sameData(GyverDBFile& db, const gdb::block_t& a, const gdb::block_t& b) {
+        if (a.typehash != b.typehash) return 0;
+        if (!a.isDynamic() || (a.ptr() && b.ptr())) return gdb::blockEquals(a, b);
+        size_t sa, sb;
+        uint32_t ca = db._dataCrc(a, sa), cb = _dataCrc(b, sb);
+        return sa == sb && ca == cb;
+    }
+
+    // заменить данные перечитанными из своего файла в db: ячейки, ссылки на файл, ленивые ячейки и блобы переходят
+    // вместе, ничего не загружается. db получает старые данные
+    void _install(GyverDBFile& db) {
+        _swapData(db);
+        _lazy.swap(db._lazy);
+        gtl::swap(_lazySrc, db._lazySrc);
+        gtl::swap(_lazyBase, db._lazyBase);
+        gtl::swap(_lazyRam, db._lazyRam);
+        gtl::swap(_lazyTick, db._lazyTick);
+        _blobs.swap(db._blobs);
+        gtl::stack<trash_t> trash;
+        trash.move(_blobTrash);
+        _blobTrash.move(db._blobTrash);
+        db._blobTrash.move(trash);
+        gtl::swap(_blobRam, db._blobRam);
+        gtl::swap(_blobSeq, db._blobSeq);
+        gtl::swap(_blobIndex, db._blobIndex);
+        gtl::swap(_dbSize, db._dbSize);
+        gtl::swap(_seq, db._seq);
+        gtl::swap(_slot, db._slot);
+#ifndef DB_NO_UPDATES
+        gtl::swap(_logSize, db._logSize);
+#endif
+        // обрыв журнала при чтении выставил _fullSave - следующая запись перепишет файл целиком
+        gtl::swap(_fullSave, db._fullSave);
+        _installing = true;
+        gdb::diffBlocks(
+            db._buf, db._len, _buf, _len,
+            [this, &db](const gdb::block_t& a, const gdb::block_t& b) { return _sameData(db, a, b); },
+            [this](const gdb::block_t* prev, const gdb::block_t* cur) {
+                _swapNotify((prev ? prev : cur)->keyHash(), cur);
+            });
+        _installing = false;
+        _update = false;
+        _skipChanges();
+    }
+
+    // вытеснить давно не использованные данные сверх бюджета. Только из tick() и update(): чтение ячеек не освобождает
+    // данные других ячеек, на которые могут указывать полученные Entry
+    void _trim() {
+        if (_lazyBudget) _evict(_lazy, _lazyRam, _lazyBudget, 0);
+        if (_blobs.length()) _evict(_blobs, _blobRam, _blobBudget, 0);
+    }
+
+    // освобождать давно не использованные данные, пока не поместится size байт (ленивые ячейки, блобы)
+    template <typename T>
+    void _evict(gdb::HashMap<T>& map, size_t& ram, size_t budget, size_t size) {
+        while (ram && ram + size > budget) {
+            size_t hash = 0;
+            uint32_t min = 0;
+            map.forEach([&](size_t h, T& l) {
+                if (l.used && (!min || l.used < min)) min = l.used, hash = h;
+            });
+            if (!min) break;
+            T* l = map.get(hash);
+            int idx = indexOf(hash);
+            if (idx >= 0) {
+                gdb::block_t& b = _buf[idx];
+                _detach(b, false);
+                if (b.ptr()) free(b.ptr());
+                b.data = 0;
+            }
+            ram -= l->size;
+            l->used = 0;
+        }
+    }
+
+    // ячейка изменена - её данные больше не в файле
+    void _lazyDrop(size_t hash) {
+        lazy_t* l = _lazy.get(hash);
+        if (!l) return;
+        if (l->used) _lazyRam -= l->size;
+        _lazy.remove(hash);
+    }
+
+    // БД записана в новый файл - данные ячеек теперь там
+    void _lazyCommit(const String& path, size_t base) {
+        if (!_watchGet) return;
+        _lazySrc = path;
+        _lazyBase = base;
+        _lazy.forEach([](size_t, lazy_t& l) { l.offset = l.next; });
+    }
+
+    void _lazyReset() {
+        _lazy.reset();
+        _lazyRam = 0;
+    }
+
+    String _blobPath(uint32_t id) {
+        return String(_path) + ".b" + String(id);
+    }
+
+    // прочитать файл блоба в ячейку с проверкой CRC
+    bool _blobRead(uint32_t id, uint16_t size, uint32_t crc, gdb::block_t& b) {
+        gdb::DBFile file = _open(_blobPath(id).c_str(), "r");
+        if (!file || !b.reserve(size)) return 0;
+        if (file.read((uint8_t*)b.buffer(), size) != size || gdb::crc32(0, b.buffer(), size) != crc) {
+            free(b.ptr());
+            b.data = 0;
+            return 0;
+        }
+        b.setSize(size);
+        return 1;
+    }
+
+    // загрузить данные блоба при обращении. Вернёт false, если ячейка не блоб
+    bool _blobFetch(gdb::block_t& b) {
+        blob_t* bl = _blobs.get(b.keyHash());
+        if (!bl) return 0;
+        if (bl->used || b.ptr()) {
+            bl->used = ++_lazyTick;
+            return 1;
+        }
+        if (!_blobRead(bl->id, bl->size, bl->crc, b)) return 1;
+        bl->used = ++_lazyTick;
+        _blobRam += bl->size;
+        return 1;
+    }
+
+    // ячейка изменена - её файл блоба устарел и удаляется после записи образа без ссылки на него
+    void _blobDrop(size_t hash) {
+        blob_t* bl = _blobs.get(hash);
+        if (!bl) return;
+        if (bl->used) _blobRam -= bl->size;
+        _blobTrash.push(trash_t{bl->id, _blobGen});
+        _blobs.remove(hash);
+        _blobIndex = true;
+    }
+
+    // записать новые и изменённые крупные ячейки в файлы блобов. Ячейка, которую не удалось записать, остаётся в образе
+    void _blobStore() {
+        if (!_blobMin) return;
+        for (size_t i = 0; i < _len; i++) {
+            gdb::block_t& b = _buf[i];
+            size_t hash = b.keyHash();
+            if ((b.type() != gdb::Type::String && b.type() != gdb::Type::Bin) || !b.ptr() || b.size() < _blobMin) continue;
+            if (_blobs.has(hash) || 4 + (_blobs.length() + 1) * sizeof(blobref_t) > 0xffff) continue;
+            blob_t bl{++_blobSeq, gdb::crc32(0, b.buffer(), b.size()), ++_lazyTick, (uint16_t)b.size()};
+            String path = _blobPath(bl.id);
+            gdb::DBFile file = _open(path.c_str(), "w");
+            if (!file || file.write((uint8_t*)b.buffer(), bl.size) != bl.size || !file.close() || !_blobs.put(hash, bl)) {
+                _st->remove(path.c_str());
+                continue;
+            }
+            _lazyDrop(hash);
+            _blobRam += bl.size;
+            _blobIndex = true;
+        }
+    }
+
+    // размер индекса блобов: номер последнего файла, ссылки и устаревшие файлы (сколько поместится в ячейку)
+    size_t _blobIndexSize() {
+        size_t n = _blobs.length() + _blobTrash.length();
+        size_t max = (0xffff - 4) / sizeof(blobref_t);
+        return 4 + (n < max ? n : max) * sizeof(blobref_t);
+    }
+
+    // собрать индекс блобов в буфер размера _blobIndexSize()
+    uint8_t* _blobIndexMake() {
+        uint8_t* p = (uint8_t*)malloc(_blobIndexSize());
+        if (!p) return nullptr;
+        memcpy(p, &_blobSeq, 4);
+        blobref_t* r = (blobref_t*)(p + 4);
+        _blobs.forEach([&](size_t hash, blob_t& bl) {
+            int idx = indexOf(hash);
+            *r++ = blobref_t{idx >= 0 ? _buf[idx].typehash : 0, bl.id, bl.size, bl.crc};
+        });
+        // устаревшие файлы - с нулевым ключом, чтобы удалить их и после перезапуска
+        for (size_t i = 0; (uint8_t*)r < p + _blobIndexSize(); i++) *r++ = blobref_t{0, _blobTrash[i].id, 0, 0};
+        return p;
+    }
+
+    // переписать данные незагруженного блоба из его файла в образ с проверкой CRC
+    bool _blobCopy(gdb::ImageWriter<gdb::BufWriter>& img, const gdb::block_t& b, const blob_t& bl) {
+        gdb::DBFile file = _open(_blobPath(bl.id).c_str(), "r");
+        if (!file) return 0;
+        img.head(b.typehash, bl.size);
+        uint32_t crc = 0;
+        uint8_t chunk[32];
+        size_t left = bl.size;
+        while (left) {
+            size_t n = file.read(chunk, left < sizeof(chunk) ? left : sizeof(chunk));
+            if (!n) return 0;
+            crc = gdb::crc32(crc, chunk, n);
+            img.data(chunk, n);
+            left -= n;
+        }
+        return crc == bl.crc;
+    }
+
+    // записать индекс блобов ячейкой образа
+    bool _blobIndexWrite(gdb::ImageWriter<gdb::BufWriter>& img) {
+        uint8_t* p = _blobIndexMake();
+        if (!p) return 0;
+        bool ok = img.record(gdb::Type::Bin, DB_BLOB_KEY, p, _blobIndexSize());
+        free(p);
+        return ok;
+    }
+
+    // применить индекс блобов прочитанного образа и убрать его из БД. В себя - ячейки без данных (читаются при обращении),
+    // в другую БД или без режима блобов - данные из файлов
+    bool _blobAttach(GyverDB& db) {
+        int idx = db.indexOf(DB_BLOB_KEY);
+        if (idx < 0) return 1;
+        gdb::Entry e = db.getN(idx);
+        size_t len = e.size();
+        uint8_t* p = (uint8_t*)malloc(len ? len : 1);
+        if (!p) return 0;
+        memcpy(p, e.buffer(), len);
+        db.remove(DB_BLOB_KEY);
+
+        bool ok = len >= 4 && !((len - 4) % sizeof(blobref_t));
+        bool cold = (&db == this) && _blobMin;
+        if (ok && &db == this) {
+            uint32_t seq;
+            memcpy(&seq, p, 4);
+            if ((int32_t)(seq - _blobSeq) > 0) _blobSeq = seq;
+        }
+        for (size_t i = 4; ok && i < len; i += sizeof(blobref_t)) {
+            blobref_t r;
+            memcpy(&r, p + i, sizeof(r));
+            if (!r.typehash) {
+                if (&db == this) _blobTrash.push(trash_t{r.id, _blobGen});
+                continue;
+            }
+            size_t hash = DB_GET_HASH(r.typehash);
+            gdb::block_t b;
+            b.typehash = r.typehash;
+            if (cold) {
+                // данные остаются в файле блоба
+                if (db.has(hash)) db.remove(hash);
+                ok = _load(b) && _blobs.put(hash, blob_t{r.id, r.crc, 0, (uint16_t)r.size});
+            } else {
+                ok = _blobRead(r.id, r.size, r.crc, b) && db._replace(b);
+                // блоб теперь в образе - файл удаляется после следующей записи
+                if (ok && &db == this) _blobTrash.push(trash_t{r.id, _blobGen});
+            }
+        }
+        free(p);
+        return ok;
+    }
+
+    // загрузить все блобы в память и выключить режим: при следующей записи они попадут в образ
+    void _blobRelease() {
+        if (!_blobs.length()) return;
+        for (size_t i = 0; i < _len; i++) _fetch(_buf[i]);
+        _blobs.forEach([this](size_t, blob_t& bl) { _blobTrash.push(trash_t{bl.id, _blobGen}); });
+        _blobReset();
+        _update = true;
+#ifndef DB_NO_UPDATES
+        _fullSave = true;  // ячеек нет в журнале - образ пишется целиком
+#endif
+    }
+
+    void _blobReset() {
+        _blobs.reset();
+        _blobRam = 0;
+    }
+
+    // образ записан целиком - удалить файлы блобов, на которые не ссылается ни один образ (в режиме слотов - ни один слот)
+    void _blobCollect() {
+        _blobGen++;
+        _blobIndex = false;
+        uint8_t keep = _slots ? _slots : 1;
+        for (size_t i = 0; i < _blobTrash.length();) {
+            if (_blobGen - _blobTrash[i].gen >= keep) {
+                _st->remove(_blobPath(_blobTrash[i].id).c_str());
+                _blobTrash.remove(i);
+            } else {
+                i++;
+            }
+        }
+    }
+
+    // взять запись из лимита в час
+    bool _takeToken(uint32_t now) {
+        if (!_perHour) return true;
+        uint32_t period = 3600000ul / _perHour;
+        uint32_t add = (now - _bucketTmr) / period;
+        if (add) {
+            _tokens = (_tokens + add > _perHour) ? _perHour : (_tokens + add);
+            _bucketTmr += add * period;
+        }
+        if (!_tokens) return false;
+        _tokens--;
+        return true;
+    }
+
+    gdb::DBFile _open(const char* path, const char* mode) {
+        return gdb::DBFile(_st->open(path, mode));
+    }
+
+    String _logPath() {
+        return String(_path) + ".log";
+    }
+
+    String _slotPath(uint8_t i) {
+        return String(_path) + "." + String(i);
+    }
+
+    bool _exists() {
+        if (_st->exists(_path)) return true;
+        for (uint8_t i = 0; i < _slots; i++) {
+            if (_st->exists(_slotPath(i).c_str())) return true;
+        }
+        return false;
+    }
+
+    // прочитать заголовок слота. Файл должен быть полным
+    bool _readSlot(uint8_t i, slot_t& h) {
+        String path = _slotPath(i);
+        if (!_st->exists(path.c_str())) return false;
+        gdb::DBFile file = _open(path.c_str(), "r");
+        if (!file || file.read((uint8_t*)&h, sizeof(h)) != sizeof(h)) return false;
+        return h.magic == DB_SLOT_MAGIC && file.size() == sizeof(h) + h.len;
+    }
+
+    // проверить CRC слота и прочитать его в БД
+    bool _loadSlot(uint8_t i, const slot_t& h, GyverDB& db) {
+        gdb::DBFile file = _open(_slotPath(i).c_str(), "r");
+        if (!file) return false;
+        uint8_t buf[32];
+        uint32_t crc = 0;
+        size_t left = h.len;
+        file.seek(sizeof(h));
+        while (left) {
+            size_t n = file.read(buf, left < sizeof(buf) ? left : sizeof(buf));
+            if (!n) return false;
+            crc = gdb::crc32(crc, buf, n);
+            left -= n;
+        }
+        if (crc != h.crc) return false;
+        file.seek(sizeof(h));
+        return _readImage(file, h.len, db, _slotPath(i), sizeof(h));
+    }
+
+    // новейший слот с целым заголовком (и номером меньше below). -1 если нет
+    int16_t _newestSlot(slot_t& bh, const uint32_t* below) {
+        // номер записи сравнивается с учётом переполнения
+        int16_t best = -1;
+        for (uint8_t i = 0; i < _slots; i++) {
+            slot_t h;
+            if (!_readSlot(i, h)) continue;
+            if (below && (int32_t)(*below - h.seq) <= 0) continue;
+            if (best < 0 || (int32_t)(h.seq - bh.seq) > 0) best = i, bh = h;
+        }
+        return best;
+    }
+
+    // прочитать новейший целый слот, при ошибке - предыдущий. -1 если целых слотов нет
+    int8_t _loadSlots(GyverDB& db) {
+        bool first = true;
+        uint32_t below = 0;
+        while (true) {
+            slot_t bh;
+            int16_t best = _newestSlot(bh, first ? nullptr : &below);
+            if (best < 0) return -1;
+            if (first) _seq = bh.seq;  // следующая запись получит номер больше всех существующих
+            first = false;
+            below = bh.seq;
+            if (_loadSlot(best, bh, db)) {
+                _slot = best;
+                _dbSize = bh.len;
+                return 1;
+            }
+        }
+    }
+
+    // записать БД в следующий слот. Предыдущие слоты не трогаются
+    bool _writeSlot() {
+        slot_t h{DB_SLOT_MAGIC, _seq + 1, 0, 0};
+        uint8_t slot = (_slot + 1) % _slots;
+        gdb::DBFile file = _open(_slotPath(slot).c_str(), "w");
+        if (!file) return false;
+        // размер и CRC известны после записи - дописываются в заголовок, до этого слот не пройдёт проверку
+        gdb::CrcPrint crc(&file);
+        if (file.write((uint8_t*)&h, sizeof(h)) != sizeof(h) || !_writeImage(crc)) return false;
+        h.len = crc.len;
+        h.crc = crc.crc;
+        if (!file.seek(0) || file.write((uint8_t*)&h, sizeof(h)) != sizeof(h)) return false;
+        if (!file.close()) return false;
+        _seq = h.seq;
+        _slot = slot;
+        _dbSize = h.len;
+        _lazyCommit(_slotPath(slot), sizeof(h));
+        return true;
+    }
+
+    // перезаписать файл БД целиком
+    bool _writeDB() {
+        if (!_writeFull()) return false;
+        _blobCollect();
+        return true;
+    }
+
+    // образ для своего файла: блобы - индексом ссылок на их файлы
+    template <typename T>
+    bool _writeImage(T& out) {
+        _fileImage = true;
+        bool ok = writeTo(out);
+        _fileImage = false;
+        return ok;
+    }
+
+    bool _writeFull() {
+        if (_slots) return _writeSlot();
+        if (_watchGet) {
+            // данные незагруженных ячеек читаются из старого файла - пишем во временный
+            String tmp = String(_path) + ".tmp";
+            gdb::DBFile file = _open(tmp.c_str(), "w");
+            if (!file) return false;
+            bool res = _writeImage(file);
+            size_t size = file.size();
+            res = file.close() && res;
+            if (!res || !_replaceFile(tmp)) return false;
+            _dbSize = size;
+            _lazyCommit(_path, 0);
+            return true;
+        }
+        gdb::DBFile file = _open(_path, "w");
+        if (!file) return false;
+        bool res = _writeImage(file);
+        _dbSize = file.size();
+        return file.close() && res;
+    }
+
+    // забыть изменения, уже сохранённые в файле
+    void _skipChanges() {
+        _tmr = 0;
+        _dirty = _dirtyBytes = 0;
+        _force = _limited = false;
+#ifndef DB_NO_UPDATES
+        _cursor.skip();
+#endif
+    }
+
+    // применить журнал к БД
+    bool _replay(GyverDB& db) {
+#ifndef DB_NO_UPDATES
+        _logSize = 0;
+        if (!_useLog) return true;
+        String path = _logPath();
+        if (!_st->exists(path.c_str())) return true;
+        gdb::DBFile file = _open(path.c_str(), "r");
+        if (!file) return false;
+        _logSize = file.size();
+
+        // обрыв в конце журнала (питание пропало во время записи) - применяем всё до него
+        gdb::BufReader buf(file, _logSize);
+        Reader reader(buf, _logSize);
+        while (reader.available()) {
+            gdb::block_t block;
+            if (!gdb::readRecord(reader, block)) {
+                // новые записи нельзя дописывать после оборванной - следующее сохранение перепишет файл и удалит журнал
+                _fullSave = true;
+                break;
+            }
+            if (block.type() == gdb::Type::None) db.remove(block.keyHash());
+            else if (!db._replace(block)) return false;
+        }
+#else
+        (void)db;
+#endif
+        return true;
+    }
+
+#ifndef DB_NO_UPDATES
+    // дописать изменённые ячейки в журнал
+    bool _appendLog() {
+        String path = _logPath();
+        gdb::DBFile file = _open(path.c_str(), "a");
+        if (!file) return false;
+        gdb::WriterSink<gdb::DBFile> sink(file);
+        gdb::BufWriter buf(sink);
+        size_t wr = 0;
+        while (_cursor.available()) {
+            size_t hash = _cursor.next();
+            if (_blobs.has(hash)) continue;  // данные в файле блоба, ссылка - в индексе
+            int idx = indexOf(hash);
+            if (idx >= 0) wr += gdb::writeRecord(buf, _buf[idx]);
+            else wr += gdb::writeTombstone(buf, hash);
+        }
+        bool ok = true;
+        if (_blobIndex) {
+            if (_blobs.length() || _blobTrash.length()) {
+                uint8_t* p = _blobIndexMake();
+                if (p) wr += gdb::writeRecord(buf, gdb::Type::Bin, DB_BLOB_KEY, p, _blobIndexSize());
+                else ok = false;
+                free(p);
+            } else {
+                wr += gdb::writeTombstone(buf, DB_BLOB_KEY);
+            }
+            _blobIndex = !ok;
+        }
+        ok = buf.flush() && ok;
+        _logSize += wr;
+        return file.close() && ok;
+    }
+
+    // переписать файл БД целиком и удалить журнал. Пока идёт запись по частям, журнал не дописывается -
+    // изменения остаются в курсоре и попадут в журнал после удаления старого
+    bool _compact(bool chunked) {
+        _skipChanges();
+        _fullSave = false;
+#ifdef DB_USE_PTHREAD
+        if (_asyncOn && !_watchGet) return _writeAsync(true);
+#endif
+        if (chunked && !_watchGet && _startSave(true)) return true;
+        if (!_writeDB()) return false;
+        _st->remove(_logPath().c_str());
+        _logSize = 0;
+        return true;
+    }
+#endif
 };
\ No newline at end of file
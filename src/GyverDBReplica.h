@@ -0,0 +1,376 @@
+#pragma once
+#include <Arduino.h>
+
+#include "GyverDB.h"
+
+// репликация: GyverDBOpLog передаёт изменения ведущей БД потоком кадров, GyverDBReplica применяет их к копии.
+// Кадр: [magic16, flags8, check8, base32, seq32, size32] [разность в формате writeDeltaTo, size байт].
+// Кадр несёт текущие значения изменённых ключей и удаления, поэтому повтор кадра не меняет реплику. base - seq предыдущего
+// кадра: реплика применяет только продолжение своей цепочки, при разрыве нужна полная синхронизация
+
+#ifndef DB_NO_UPDATES
+
+#define DB_OPLOG_MAGIC 0x4C4F     // OL
+#define DB_OPLOG_BEGIN (1 << 0)  // первый кадр полной синхронизации
+#define DB_OPLOG_FULL (1 << 1)   // кадр полной синхронизации: реплика собирает копию отдельно
+#define DB_OPLOG_END (1 << 2)    // последний кадр полной синхронизации: копия заменяет данные реплики
+
+#ifndef DB_OPLOG_MAX
+#define DB_OPLOG_MAX 0x20000ul  // наибольший принимаемый размер разности в кадре
+#endif
+
+namespace gdb {
+
+// заголовок кадра реплики
+struct oplog_t {
+    uint16_t magic;
+    uint8_t flags;
+    uint8_t check;  // младший байт CRC32 полей flags, base, seq, size: отсекает случайное совпадение magic в потоке
+    uint32_t base;  // seq предыдущего кадра: кадр содержит изменения после него
+    uint32_t seq;   // номер изменения ведущей БД, по которое включительно кадр содержит изменения
+    uint32_t size;  // размер разности
+
+    uint8_t sum() const {
+        return crc32(crc32(crc32(crc32(0, &flags, 1), &base, 4), &seq, 4), &size, 4);
+    }
+};
+
+}  // namespace gdb
+
+// источник репликации: отправляет изменения БД кадрами по batch ключей. Подключение начинается с полной синхронизации,
+// затем идут только изменённые ключи (курсор изменений). Несколько изменений ключа до отправки - одна запись
+class GyverDBOpLog {
+   public:
+    GyverDBOpLog(GyverDB& db, uint16_t batch = 32) : _db(&db), _batch(batch ? batch : 1) {
+        resync();
+    }
+
+    GyverDBOpLog(const GyverDBOpLog& o) = delete;
+    GyverDBOpLog& operator=(const GyverDBOpLog& o) = delete;
+
+    ~GyverDBOpLog() {
+        free(_frame);
+    }
+
+    // компактные кадры: ключи разностями, числа varint. lz - сжимать строки и бинарные данные (умолч. компактные без сжатия)
+    void useCompact(bool compact, bool lz = false) {
+        _mode = compact ? (DB_IMAGE_COMPACT | (lz ? DB_IMAGE_LZ : 0)) : 0;
+    }
+
+    // начать полную синхронизацию (новое подключение реплики). Начатый кадр сначала дописывается
+    void resync() {
+        if (!_sent) _drop();
+        _cursor = _db->cursor();
+        _keys.clear();
+        _syncSeq = _cursor.position();
+        _syncIdx = 0;
+        _syncHash = 0;
+        _full = _begin = true;
+    }
+
+    // идёт полная синхронизация
+    bool syncing() {
+        return _full;
+    }
+
+    // есть неотправленные изменения
+    bool pending() {
+        return _flen || _full || _keys.length() || _cursor.available();
+    }
+
+    // номер последнего изменения БД, отправленного реплике
+    uint32_t seq() {
+        return _seq;
+    }
+
+    // отправить кадры в out (Print, Stream, клиент), не больше frames за вызов. Приёмник может принять часть кадра
+    // (write вернул меньше) - остаток отправится при следующем вызове. Вернёт true, если отправлено всё
+    template <typename T>
+    bool tick(T& out, uint16_t frames = 4) {
+        while (true) {
+            if (_sent < _flen) {
+                _sent += out.write(_frame + _sent, _flen - _sent);
+                if (_sent < _flen) return 0;
+                _seq = _fseq;
+            }
+            _drop();
+            if (!frames-- || !_make()) break;
+        }
+        return !pending();
+    }
+
+   private:
+    GyverDB* _db;
+    GyverDB::Cursor _cursor;
+    gtl::stack<uint32_t> _keys;  // ключи следующего кадра
+    uint8_t* _frame = nullptr;
+    size_t _flen = 0, _sent = 0;
+    uint32_t _seq = 0, _fseq = 0, _syncSeq = 0, _syncHash = 0;
+    size_t _syncIdx = 0;
+    uint16_t _batch;
+    uint8_t _mode = DB_IMAGE_COMPACT;
+    bool _full = false, _begin = false;
+
+    void _drop() {
+        free(_frame);
+        _frame = nullptr;
+        _flen = _sent = 0;
+    }
+
+    // позиция полной синхронизации: после последнего отправленного ключа, даже если БД изменилась между кадрами
+    size_t _syncFrom() {
+        if (!_syncIdx) return 0;
+        if (_syncIdx <= _db->length() && _db->getN(_syncIdx - 1).keyHash() == _syncHash) return _syncIdx;
+        int i = _db->indexOf(_syncHash);
+        if (i >= 0) return i + 1;
+        size_t low = 0, high = _db->length();
+        while (low < high) {
+            size_t mid = low + ((high - low) >> 1);
+            if (_db->getN(mid).keyHash() < _syncHash) low = mid + 1;
+            else high = mid;
+        }
+        return low;
+    }
+
+    // собрать следующий кадр. Прочитанные из курсора ключи остаются в _keys, пока кадр не собран
+    bool _make() {
+        uint8_t flags = 0;
+        uint32_t seq, base = _seq;
+        size_t end = 0;
+        if (_full) {
+            flags = DB_OPLOG_FULL | (_begin ? DB_OPLOG_BEGIN : 0);
+            seq = _syncSeq;
+            if (!_begin) base = _syncSeq;  // кадры одной синхронизации
+            _keys.clear();
+            end = _syncFrom();
+            while (end < _db->length() && _keys.length() < _batch) {
+                if (!_keys.push(_db->getN(end).keyHash())) return 0;
+                end++;
+            }
+            if (end >= _db->length()) flags |= DB_OPLOG_END;
+        } else {
+            if (_cursor.lost()) {
+                resync();
+                return _make();
+            }
+            if (!_keys.reserve(_batch)) return 0;
+            while (_keys.length() < _batch && _cursor.available()) _keys.push(_cursor.next());
+            if (!_keys.length()) return 0;
+            qsort(&_keys[0], _keys.length(), sizeof(uint32_t), [](const void* a, const void* b) -> int {
+                uint32_t ha = *(const uint32_t*)a, hb = *(const uint32_t*)b;
+                return (ha > hb) - (ha < hb);
+            });
+            // ключ мог остаться от несобранного кадра и измениться снова
+            size_t n = 1;
+            for (size_t i = 1; i < _keys.length(); i++) {
+                if (_keys[i] != _keys[n - 1]) _keys[n++] = _keys[i];
+            }
+            while (_keys.length() > n) _keys.pop();
+            seq = _cursor.position();
+        }
+
+        // размер холостым проходом, затем кадр в память
+        gdb::SizeCounter cnt;
+        _encode(cnt);
+        size_t len = sizeof(gdb::oplog_t) + cnt.len;
+        _frame = (uint8_t*)malloc(len);
+        if (!_frame) return 0;
+        gdb::oplog_t h{DB_OPLOG_MAGIC, flags, 0, base, seq, (uint32_t)cnt.len};
+        h.check = h.sum();
+        memcpy(_frame, &h, sizeof(h));
+        Writer w(_frame + sizeof(h));
+        if (!_encode(w)) {
+            _drop();
+            return 0;
+        }
+        _flen = len;
+        _fseq = seq;
+
+        if (_full) {
+            _syncHash = _keys.length() ? _keys[_keys.length() - 1] : 0;
+            _syncIdx = end;
+            _begin = false;
+            if (flags & DB_OPLOG_END) _full = false;
+        }
+        _keys.clear();
+        return 1;
+    }
+
+    // разность из текущих значений ключей кадра
+    template <typename W>
+    bool _encode(W& w) {
+        gdb::ImageWriter<W> img(w);
+        img.begin(_keys.length(), true, _mode | DB_IMAGE_DELTA);
+        for (size_t i = 0; i < _keys.length(); i++) {
+            gdb::Entry e = _db->get(_keys[i]);
+            if (e.valid()) img.record(e.type(), _keys[i], e.buffer(), e.size());
+            else img.tombstone(_keys[i]);
+        }
+        return img.end();
+    }
+};
+
+// реплика: принимает кадры GyverDBOpLog и применяет каждый одной разностью (applyDelta). Повторные и устаревшие кадры
+// пропускаются, повреждённые отбрасываются с поиском следующего заголовка. Кадр после разрыва цепочки (base не равен
+// seq реплики) и изменения до первой полной синхронизации не применяются - реплике нужна полная синхронизация.
+// Полная синхронизация собирается в отдельной БД и применяется патчем в конце, обработчики реплики получат только
+// действительно изменившиеся ячейки
+class GyverDBReplica {
+   public:
+    GyverDBReplica(GyverDB& db) : _db(&db) {}
+
+    GyverDBReplica(const GyverDBReplica& r) = delete;
+    GyverDBReplica& operator=(const GyverDBReplica& r) = delete;
+
+    ~GyverDBReplica() {
+        free(_data);
+    }
+
+    // прочитать доступные данные из Stream без ожидания и применить принятые кадры. Вернёт количество применённых кадров
+    size_t tick(Stream& in) {
+        size_t n = 0;
+        uint8_t buf[64];
+        int av;
+        while ((av = in.available()) > 0) {
+            size_t len = in.readBytes(buf, ((size_t)av < sizeof(buf)) ? (size_t)av : sizeof(buf));
+            if (!len) break;
+            n += feed(buf, len);
+        }
+        return n;
+    }
+
+    // принять данные из своего транспорта. Вернёт количество применённых кадров
+    size_t feed(const uint8_t* data, size_t len) {
+        size_t n = 0;
+        while (len) {
+            size_t part;
+            if (_got < sizeof(gdb::oplog_t)) {
+                part = sizeof(gdb::oplog_t) - _got;
+                if (part > len) part = len;
+                memcpy((uint8_t*)&_head + _got, data, part);
+                _got += part;
+                if (_got == sizeof(gdb::oplog_t) && !_start()) {
+                    // поиск следующего заголовка со сдвигом на байт
+                    memmove(&_head, (uint8_t*)&_head + 1, sizeof(gdb::oplog_t) - 1);
+                    _got--;
+                }
+            } else {
+                part = _head.size - (_got - sizeof(gdb::oplog_t));
+                if (part > len) part = len;
+                if (_data) memcpy(_data + _got - sizeof(gdb::oplog_t), data, part);
+                _got += part;
+            }
+            data += part;
+            len -= part;
+            if (_got >= sizeof(gdb::oplog_t) && _got - sizeof(gdb::oplog_t) == _head.size) n += _apply();
+        }
+        return n;
+    }
+
+    // номер последнего применённого изменения ведущей БД
+    uint32_t seq() {
+        return _seq;
+    }
+
+    // идёт полная синхронизация: данные реплики ещё прежние
+    bool syncing() {
+        return _sync;
+    }
+
+    // нужна полная синхронизация: реплика ещё не синхронизирована или пропустила кадры. Источнику - вызвать resync()
+    bool needsResync() {
+        return (!_synced || _lost) && !_sync;
+    }
+
+    // количество отброшенных кадров (ошибка формата, нехватка памяти)
+    uint32_t errors() {
+        return _errors;
+    }
+
+   private:
+    GyverDB* _db;
+    GyverDB _copy;  // собираемая полная синхронизация
+    gdb::oplog_t _head;
+    uint8_t* _data = nullptr;
+    size_t _got = 0;
+    uint32_t _seq = 0, _syncSeq = 0, _errors = 0;
+    bool _sync = false, _synced = false, _lost = false, _bad = false;
+
+    // заголовок принят. Вернёт false, если это не заголовок кадра
+    bool _start() {
+        if (_head.magic != DB_OPLOG_MAGIC || _head.check != _head.sum() || _head.size > DB_OPLOG_MAX) {
+            if (!_bad) _errors++;
+            _bad = true;
+            return 0;
+        }
+        _bad = false;
+        _data = (uint8_t*)malloc(_head.size ? _head.size : 1);  // без памяти кадр дочитывается и отбрасывается
+        return 1;
+    }
+
+    // кадр принят целиком
+    bool _apply() {
+        bool ok = _data;
+        bool done = false;
+        uint8_t flags = _head.flags;
+        if (ok && (flags & DB_OPLOG_FULL)) {
+            if (flags & DB_OPLOG_BEGIN) {
+                _copy.reset();
+                _sync = true;
+                _syncSeq = _head.seq;
+            } else if (_sync && (_head.base != _syncSeq || _head.seq != _syncSeq)) {
+                _abort();  // кадр другой синхронизации
+            }
+            // кадры без начала синхронизации пропускаются до следующей
+            if (_sync) {
+                ok = _copy.applyDelta(_data, _head.size);
+                if (ok && (flags & DB_OPLOG_END)) ok = _finish();
+                done = ok;
+                if (!ok) _abort();
+            }
+        } else if (ok && !(_synced && (int32_t)(_head.seq - _seq) <= 0)) {
+            if (_sync || !_synced || _head.base != _seq) {
+                // изменения без полной синхронизации или после пропущенного кадра
+                if (_sync) _abort();
+                _lost = true;
+            } else {
+                ok = done = _db->applyDelta(_data, _head.size);
+                if (done) _seq = _head.seq;
+            }
+        }
+        if (!ok) _errors++;
+        free(_data);
+        _data = nullptr;
+        _got = 0;
+        return done;
+    }
+
+    // прервать полную синхронизацию: реплика остаётся с прежними данными
+    void _abort() {
+        _copy.reset();
+        _sync = false;
+        _lost = true;
+    }
+
+    // применить собранную копию патчем: изменённые ячейки и удаление лишних
+    bool _finish() {
+        size_t len = _db->patchSize(_copy);
+        uint8_t* patch = len ? (uint8_t*)malloc(len) : nullptr;
+        bool ok = patch;
+        if (ok) {
+            Writer w(patch);
+            ok = _db->writePatchTo(w, _copy) && _db->applyDelta(patch, len);
+        }
+        free(patch);
+        _copy.reset();
+        _sync = false;
+        if (ok) {
+            _seq = _syncSeq;
+            _synced = true;
+            _lost = false;
+        }
+        return ok;
+    }
+};
+
+#endif
@@ -0,0 +1,177 @@
+#pragma once
+#include <Arduino.h>
+
+#include "GyverDBConcurrent.h"
+
+// БД из N независимых частей (N - степень двойки), ключ попадает в часть по младшим битам хэша.
+// У каждой части своя блокировка - запись в разные части идёт параллельно
+template <uint8_t N>
+class GyverDBSharded {
+    static_assert(N && !(N & (N - 1)), "N must be a power of 2");
+
+   public:
+    // часть БД, в которой хранится ключ
+    GyverDBConcurrent& shard(size_t hash) {
+        return _shards[(hash & DB_HASH_MASK) & (N - 1)];
+    }
+    GyverDBConcurrent& shard(const Text& key) {
+        return shard(key.hash());
+    }
+
+    // часть БД по номеру
+    GyverDBConcurrent& shardN(uint8_t n) {
+        return _shards[n];
+    }
+
+    // количество частей
+    constexpr uint8_t shards() const {
+        return N;
+    }
+
+    // ================== READ ==================
+
+    bool has(size_t hash) { return shard(hash).has(hash); }
+    bool has(const Text& key) { return has(key.hash()); }
+
+    // прочитать ячейку: f(const gdb::Entry& entry) вызывается под блокировкой чтения части. Вернёт false если ячейки нет
+    template <typename F>
+    bool read(size_t hash, F f) { return shard(hash).read(hash, f); }
+
+    gdb::Type type(size_t hash) { return shard(hash).type(hash); }
+    bool getBool(size_t hash) { return shard(hash).getBool(hash); }
+    int32_t getInt(size_t hash) { return shard(hash).getInt(hash); }
+    int64_t getInt64(size_t hash) { return shard(hash).getInt64(hash); }
+    float getFloat(size_t hash) { return shard(hash).getFloat(hash); }
+    String getString(size_t hash) { return shard(hash).getString(hash); }
+
+    template <typename T>
+    bool getTo(size_t hash, T& dest) { return shard(hash).getTo(hash, dest); }
+
+    size_t getBytes(size_t hash, void* buf, size_t len) { return shard(hash).getBytes(hash, buf, len); }
+
+    // количество ячеек во всех частях
+    size_t length() {
+        size_t len = 0;
+        for (uint8_t i = 0; i < N; i++) len += _shards[i].length();
+        return len;
+    }
+
+    // экспортный размер БД (для writeTo)
+    size_t writeSize() {
+        // заголовок и CRC образа учитываются один раз
+        size_t head = gdb::imageSize(nullptr, 0), sz = head;
+        for (uint8_t i = 0; i < N; i++) sz += _shards[i].writeSize() - head;
+        return sz;
+    }
+
+    // экспортировать БД в Stream в формате GyverDB: части сливаются в один отсортированный образ.
+    // Все части блокируются на чтение на время экспорта - образ согласован
+    template <typename T>
+    bool writeTo(T& writer) {
+        for (uint8_t i = 0; i < N; i++) _shards[i]._lock.lockRead();
+
+        size_t idx[N] = {};
+        size_t len = 0;
+        for (uint8_t i = 0; i < N; i++) len += _shards[i]._db.length();
+        gdb::WriterSink<T> sink(writer);
+        gdb::BufWriter buf(sink);
+        gdb::ImageWriter<gdb::BufWriter> img(buf);
+        img.begin(len);
+
+        // N-путевое слияние по хэшу ключа
+        while (true) {
+            int8_t min = -1;
+            size_t minh = 0;
+            for (uint8_t i = 0; i < N; i++) {
+                if (idx[i] >= _shards[i]._db.length()) continue;
+                size_t h = _shards[i]._db.getN(idx[i]).keyHash();
+                if (min < 0 || h < minh) {
+                    min = i;
+                    minh = h;
+                }
+            }
+            if (min < 0) break;
+            gdb::Entry e = _shards[min]._db.getN(idx[min]++);
+            img.record(e.type(), e.keyHash(), e.buffer(), e.size());
+        }
+        bool res = img.end() && buf.flush();
+
+        for (uint8_t i = 0; i < N; i++) _shards[i]._lock.unlockRead();
+        return res;
+    }
+
+    // ================== WRITE ==================
+
+    bool set(size_t hash, gdb::AnyType val) { return shard(hash).set(hash, val); }
+    bool set(const Text& key, gdb::AnyType val) { return set(key.hash(), val); }
+
+    bool init(size_t hash, gdb::AnyType val) { return shard(hash).init(hash, val); }
+    bool init(const Text& key, gdb::AnyType val) { return init(key.hash(), val); }
+
+    bool update(size_t hash, gdb::AnyType val) { return shard(hash).update(hash, val); }
+    bool update(const Text& key, gdb::AnyType val) { return update(key.hash(), val); }
+
+    bool create(size_t hash, gdb::Type type, uint16_t reserve = 0) { return shard(hash).create(hash, type, reserve); }
+
+    void remove(size_t hash) { shard(hash).remove(hash); }
+    void remove(const Text& key) { remove(key.hash()); }
+
+    // стереть все ячейки
+    void clear() {
+        for (uint8_t i = 0; i < N; i++) _shards[i].clear();
+    }
+
+    // импортировать БД из Stream (напр. файл)
+    bool readFrom(Stream& stream, size_t len) {
+        gdb::StreamSource src(stream);
+        return readFrom(src, len);
+    }
+
+    // импортировать БД из источника (файл, сокет)
+    bool readFrom(gdb::Source& source, size_t len) {
+        gdb::BufReader buf(source, len);
+        return _readFrom(Reader(buf, len));
+    }
+
+    // импортировать БД из буфера
+    bool readFrom(const uint8_t* buffer, size_t len) {
+        return _readFrom(Reader(buffer, len));
+    }
+
+    // тикер, вызывать в loop
+    bool tick() {
+        bool res = false;
+        for (uint8_t i = 0; i < N; i++) res |= _shards[i].tick();
+        return res;
+    }
+
+   private:
+    GyverDBConcurrent _shards[N];
+
+    // все части блокируются на запись - читатели не увидят частично загруженную БД
+    bool _readFrom(Reader reader) {
+        for (uint8_t i = 0; i < N; i++) {
+            _shards[i]._lock.lockWrite();
+            _shards[i]._ver++;
+            _shards[i]._db.clear();
+        }
+
+        gdb::ImageReader img;
+        bool res = img.begin(reader) && !(img.flags & DB_IMAGE_DELTA);  // разность применяется через applyDelta
+        bool sorted = img.flags & DB_IMAGE_SORTED;
+        if (res) {
+            for (uint8_t i = 0; i < N; i++) _shards[i]._db.reserve(img.len / N + 1);
+        }
+
+        // прочитанный блок переходит в часть без копирования: записи отсортированного образа - в конец части
+        while (res && img.available(reader)) {
+            gdb::block_t block;
+            res = img.next(reader, block) && shard(block.keyHash())._db._take(block, sorted);
+        }
+        if (res) res = img.end(reader);
+        for (uint8_t i = 0; i < N; i++) _shards[i]._db._takeEnd();
+
+        for (uint8_t i = 0; i < N; i++) _shards[i]._lock.unlockWrite();
+        return res;
+    }
+};
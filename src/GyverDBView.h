@@ -0,0 +1,204 @@
+#pragma once
+#include <Arduino.h>
+
+#include "GyverDB.h"
+
+// БД только для чтения поверх образа в формате writeTo (буфер, отображённая флешка или файл).
+// Данные не копируются: ячейки указывают прямо в образ, который должен существовать, пока используется вид
+class GyverDBView {
+   public:
+    GyverDBView() {}
+    GyverDBView(const uint8_t* image, size_t len) {
+        begin(image, len);
+    }
+
+    GyverDBView(const GyverDBView& v) = delete;
+    GyverDBView& operator=(const GyverDBView& v) = delete;
+
+    ~GyverDBView() {
+        end();
+    }
+
+    // разобрать образ. Вернёт false при ошибке формата или нехватке памяти
+    bool begin(const uint8_t* image, size_t len) {
+        end();
+        uint8_t flags;
+        uint32_t count = 0;
+        uint8_t head = image ? gdb::imageHeader(image, len, _ver, flags, count) : 0;
+        if (!head || (flags & (DB_IMAGE_COMPACT | DB_IMAGE_SEGMENTS | DB_IMAGE_DELTA))) return 0;  // только образ из записей подряд в формате ячеек
+        if (_ver >= 2) {
+            // CRC записей в конце образа
+            uint32_t crc;
+            if (len < head + 4u) return 0;
+            len -= 4;
+            memcpy(&crc, image + len, 4);
+            if (gdb::crc32(0, image + head, len - head) != crc) return 0;
+        }
+
+        // 64-бит числа копируются в выровненный массив, остальные данные остаются в образе
+        size_t n64 = 0;
+        const uint8_t* p = image + head;
+        const uint8_t* endp = image + len;
+        _blocks = count ? (gdb::block_t*)malloc(count * sizeof(gdb::block_t)) : nullptr;
+        if (count && !_blocks) return 0;
+
+        while (p < endp) {
+            gdb::block_t b;
+            if (endp - p < 4 || _len >= count) return _fail();
+            memcpy(&b.typehash, p, 4);
+            p += 4;
+            if (_len && _blocks[_len - 1].keyHash() >= b.keyHash()) return _fail();  // образ должен быть отсортирован
+
+            if (b.isDynamic()) {
+                uint16_t size;
+                if (_ver >= 2) {
+                    // старшая половина размера зарезервирована: ячейки до 64 КБ
+                    if (endp - p < 2 || p[0] || p[1]) return _fail();
+                    p += 2;
+                }
+                if (endp - p < 2) return _fail();
+                memcpy(&size, p, 2);
+                if ((size_t)(endp - p) < 2u + size) return _fail();
+                if (b.type() == gdb::Type::String || b.type() == gdb::Type::Bin) {
+                    b.data = (gdb::data_t)(uintptr_t)p;  // указатель на размер, данные следом
+                } else {
+                    if (size != 8) return _fail();
+                    n64++;
+                }
+                p += 2 + size;
+            } else {
+                if (endp - p < 4) return _fail();
+                uint32_t data;
+                memcpy(&data, p, 4);
+                b.data = data;
+                p += 4;
+            }
+            _blocks[_len++] = b;
+        }
+        if (_len != count) return _fail();
+
+        if (n64) {
+            _i64 = (uint64_t*)malloc(n64 * 8);
+            if (!_i64) return _fail();
+            _fill64(image + head);
+        }
+        _img = image;
+        _imgLen = (_ver >= 2) ? len + 4 : len;
+        return 1;
+    }
+
+    // освободить индекс
+    void end() {
+        free(_blocks);
+        free(_i64);
+        _blocks = nullptr;
+        _i64 = nullptr;
+        _img = nullptr;
+        _len = _imgLen = 0;
+    }
+
+    // вид создан
+    bool valid() const {
+        return _img;
+    }
+    explicit operator bool() const {
+        return valid();
+    }
+
+    // количество ячеек
+    size_t length() const {
+        return _len;
+    }
+
+    // порядковый номер ячейки или -1, если её нет
+    int indexOf(size_t hash) const {
+        hash &= DB_HASH_MASK;
+        int low = 0, high = (int)_len - 1;
+        while (low <= high) {
+            int mid = low + ((high - low) >> 1);
+            if (_blocks[mid].keyHash() == hash) return mid;
+            if (_blocks[mid].keyHash() < hash) low = mid + 1;
+            else high = mid - 1;
+        }
+        return -1;
+    }
+    int indexOf(const Text& key) const {
+        return indexOf(key.hash());
+    }
+
+    // вид содержит ячейку
+    bool has(size_t hash) const {
+        return indexOf(hash) >= 0;
+    }
+    bool has(const Text& key) const {
+        return has(key.hash());
+    }
+
+    // получить ячейку. Строки не оканчиваются нулём - используйте длину или toString()
+    gdb::Entry get(size_t hash) const {
+        return getN(indexOf(hash));
+    }
+    gdb::Entry get(const Text& key) const {
+        return get(key.hash());
+    }
+    gdb::Entry operator[](size_t hash) const {
+        return get(hash);
+    }
+    gdb::Entry operator[](const Text& key) const {
+        return get(key);
+    }
+
+    // получить ячейку по порядку
+    gdb::Entry getN(int idx) const {
+        return (idx >= 0 && idx < (int)_len) ? gdb::Entry(_blocks[idx]) : gdb::Entry();
+    }
+
+    // экспортный размер (для writeTo)
+    size_t writeSize() const {
+        return gdb::imageSize(_blocks, _len);
+    }
+
+    // экспортировать в Stream в формате GyverDB
+    template <typename T>
+    bool writeTo(T& writer) const {
+        return gdb::writeImage(writer, _blocks, _len);
+    }
+
+    // скопировать в обычную БД
+    bool copyTo(GyverDB& db) const {
+        return _img && db.readFrom(_img, _imgLen);
+    }
+
+   private:
+    gdb::block_t* _blocks = nullptr;
+    uint64_t* _i64 = nullptr;
+    const uint8_t* _img = nullptr;
+    size_t _len = 0, _imgLen = 0;
+    uint8_t _ver = 1;
+
+    bool _fail() {
+        end();
+        return 0;
+    }
+
+    // скопировать 64-бит числа и указать на них ячейки
+    void _fill64(const uint8_t* p) {
+        size_t k = 0;
+        for (size_t i = 0; i < _len; i++) {
+            gdb::block_t& b = _blocks[i];
+            p += 4;
+            if (b.isDynamic()) {
+                uint16_t size;
+                if (_ver >= 2) p += 2;
+                memcpy(&size, p, 2);
+                if (b.type() != gdb::Type::String && b.type() != gdb::Type::Bin) {
+                    memcpy(&_i64[k], p + 2, 8);
+                    b.data = (gdb::data_t)(uintptr_t)&_i64[k++];
+                }
+                p += 2 + size;
+            } else {
+                p += 4;
+            }
+        }
+    }
+};
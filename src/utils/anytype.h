@@ -21,6 +21,7 @@ class AnyType {
     template <typename T>
     AnyType(const T& value) : ptr(&value), len(sizeof(T)), type(Type::Bin) {}
     AnyType(const void* ptr, size_t len) : ptr(ptr), len(len), type(Type::Bin) {}
+    AnyType(Type type, const void* ptr, size_t len) : ptr(ptr), len(len), type(type) {}
 
     AnyType(const char* str, size_t len) : ptr(str), len(len), type(Type::String) {}
     AnyType(const char* str) : AnyType(str, strlen(str)) {}
@@ -0,0 +1,151 @@
+#pragma once
+#include <Arduino.h>
+#include <GTL.h>
+
+#include "rwlock.h"
+
+#ifdef DB_USE_PTHREAD
+
+namespace gdb {
+
+// запись буфера в отдельном потоке. Пока поток пишет, следующий буфер заполняется и заменяет ещё не записанный
+class AsyncWriter {
+   public:
+    typedef bool (*WriteFn)(void* ctx, const uint8_t* buf, size_t len);
+
+    AsyncWriter() {
+        pthread_mutex_init(&_mutex, nullptr);
+        pthread_cond_init(&_cond, nullptr);
+        pthread_cond_init(&_idle, nullptr);
+    }
+    AsyncWriter(const AsyncWriter& w) = delete;
+    AsyncWriter& operator=(const AsyncWriter& w) = delete;
+
+    ~AsyncWriter() {
+        end();
+        free(_next);
+        free(_work);
+        pthread_mutex_destroy(&_mutex);
+        pthread_cond_destroy(&_cond);
+        pthread_cond_destroy(&_idle);
+    }
+
+    // запустить поток. fn(ctx, buf, len) вызывается в потоке для каждого буфера
+    bool begin(WriteFn fn, void* ctx) {
+        if (_running) return 1;
+        _fn = fn;
+        _ctx = ctx;
+        _stop = false;
+        if (pthread_create(&_thread, nullptr, _run, this)) return 0;
+        _running = true;
+        return 1;
+    }
+
+    // остановить поток. Ожидающий буфер будет записан
+    void end() {
+        if (!_running) return;
+        pthread_mutex_lock(&_mutex);
+        _stop = true;
+        pthread_cond_signal(&_cond);
+        pthread_mutex_unlock(&_mutex);
+        pthread_join(_thread, nullptr);
+        _running = false;
+    }
+
+    // поток запущен
+    bool running() {
+        return _running;
+    }
+
+    // заполнить буфер размера len через fill(uint8_t* buf) и отдать потоку. Вернёт false при нехватке памяти
+    template <typename F>
+    bool write(size_t len, F fill) {
+        pthread_mutex_lock(&_mutex);
+        if (len > _nextCap) {
+            uint8_t* p = (uint8_t*)realloc(_next, len);
+            if (!p) {
+                pthread_mutex_unlock(&_mutex);
+                return 0;
+            }
+            _next = p;
+            _nextCap = len;
+        }
+        fill(_next);
+        _nextLen = len;
+        _ready = true;
+        pthread_cond_signal(&_cond);
+        pthread_mutex_unlock(&_mutex);
+        return 1;
+    }
+
+    // идёт или ожидает запись
+    bool busy() {
+        pthread_mutex_lock(&_mutex);
+        bool b = _ready || _busy;
+        pthread_mutex_unlock(&_mutex);
+        return b;
+    }
+
+    // дождаться окончания записи
+    void wait() {
+        pthread_mutex_lock(&_mutex);
+        while (_running && (_ready || _busy)) pthread_cond_wait(&_idle, &_mutex);
+        pthread_mutex_unlock(&_mutex);
+    }
+
+    // запись завершилась с момента прошлого вызова. ok - все записи с прошлого вызова успешны
+    bool done(bool& ok) {
+        pthread_mutex_lock(&_mutex);
+        bool d = _done;
+        ok = _ok;
+        _done = false;
+        _ok = true;
+        pthread_mutex_unlock(&_mutex);
+        return d;
+    }
+
+   private:
+    pthread_t _thread;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond, _idle;
+    WriteFn _fn = nullptr;
+    void* _ctx = nullptr;
+    uint8_t *_next = nullptr, *_work = nullptr;
+    size_t _nextLen = 0, _nextCap = 0, _workLen = 0, _workCap = 0;
+    bool _running = false, _stop = false, _ready = false, _busy = false, _done = false, _ok = true;
+
+    static void* _run(void* p) {
+        ((AsyncWriter*)p)->_loop();
+        return nullptr;
+    }
+
+    void _loop() {
+        pthread_mutex_lock(&_mutex);
+        while (true) {
+            while (!_ready && !_stop) pthread_cond_wait(&_cond, &_mutex);
+            if (!_ready) break;
+
+            // забираем заполненный буфер, освободившийся отдаём под следующий
+            gtl::swap(_next, _work);
+            gtl::swap(_nextCap, _workCap);
+            _workLen = _nextLen;
+            _ready = false;
+            _busy = true;
+            pthread_mutex_unlock(&_mutex);
+
+            bool ok = _fn(_ctx, _work, _workLen);
+
+            pthread_mutex_lock(&_mutex);
+            _busy = false;
+            _done = true;
+            _ok = _ok && ok;
+            pthread_cond_broadcast(&_idle);
+        }
+        pthread_cond_broadcast(&_idle);
+        pthread_mutex_unlock(&_mutex);
+    }
+};
+
+}  // namespace gdb
+
+#endif
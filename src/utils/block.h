@@ -5,17 +5,24 @@
 
 namespace gdb {
 
+// ячейка хранит 32 бит данные или указатель. На 64-бит платформах (хост) под указатель нужно 8 байт
+#if UINTPTR_MAX > 0xFFFFFFFFul
+typedef uintptr_t data_t;
+#else
+typedef uint32_t data_t;
+#endif
+
 class block_t {
    public:
     block_t() {}
     block_t(Type type, size_t hash) : typehash(DB_MAKE_TYPEHASH(type, hash)) {}
 
     uint32_t typehash = 0;
-    uint32_t data = 0;
+    data_t data = 0;
 
     // указатель на динамические данные
     inline void* ptr() const {
-        return (void*)data;
+        return (void*)(uintptr_t)data;
     }
 
     // указатель непосредственно на данные размера size()
@@ -94,7 +101,7 @@ class block_t {
             if (isDynamic()) {
                 void* p = realloc(ptr(), realLen(len));
                 if (!p) return 0;
-                data = (uint32_t)p;
+                data = (data_t)(uintptr_t)p;
                 return 1;
             } else {
                 if (len <= 4) return 1;
@@ -180,7 +187,8 @@ class block_t {
             case Type::Bin:
             case Type::String:
                 if (ptr()) {
-                    *((uint16_t*)ptr()) = len;
+                    uint16_t len16 = len;
+                    memcpy(ptr(), &len16, 2);
                     if (type() == Type::String) ((char*)buffer())[len] = 0;
                 }
                 break;
@@ -228,8 +236,12 @@ class block_t {
     size_t size() const {
         switch (type()) {
             case Type::String:
-            case Type::Bin:
-                return ptr() ? *((uint16_t*)ptr()) : 0;
+            case Type::Bin: {
+                // размер может быть не выровнен (ячейка внутри образа GyverDBView)
+                uint16_t len = 0;
+                if (ptr()) memcpy(&len, ptr(), 2);
+                return len;
+            }
 
             default:
                 return Converter::size(type());
@@ -0,0 +1,163 @@
+#pragma once
+#include <Arduino.h>
+
+#ifndef DB_IO_BUF
+#define DB_IO_BUF 512  // размер блока буферизованной записи и чтения образа (512..4096)
+#endif
+
+namespace gdb {
+
+// приёмник данных образа (файл, сокет, память)
+class Sink {
+   public:
+    virtual size_t write(const uint8_t* buf, size_t len) = 0;
+};
+
+// источник данных образа (файл, сокет, память)
+class Source {
+   public:
+    virtual size_t read(uint8_t* buf, size_t len) = 0;
+};
+
+// приёмник поверх объекта с write(buf, len) (Print, File, Writer)
+template <typename T>
+class WriterSink : public Sink {
+   public:
+    WriterSink(T& writer) : _w(writer) {}
+
+    size_t write(const uint8_t* buf, size_t len) override {
+        return _w.write((uint8_t*)buf, len);
+    }
+
+   private:
+    T& _w;
+};
+
+// источник поверх Stream
+class StreamSource : public Source {
+   public:
+    StreamSource(Stream& stream) : _s(stream) {}
+
+    size_t read(uint8_t* buf, size_t len) override {
+        return _s.readBytes(buf, len);
+    }
+
+   private:
+    Stream& _s;
+};
+
+// запись блоками по chunk байт: мелкие записи полей собираются в буфер. Без памяти под буфер пишет напрямую
+class BufWriter : public Sink {
+   public:
+    BufWriter(Sink& out, size_t chunk = DB_IO_BUF) : _out(out) {
+        _buf = (uint8_t*)malloc(chunk);
+        _cap = _buf ? chunk : 0;
+    }
+    BufWriter(const BufWriter& w) = delete;
+    BufWriter& operator=(const BufWriter& w) = delete;
+
+    ~BufWriter() {
+        flush();
+        free(_buf);
+    }
+
+    size_t write(const uint8_t* buf, size_t len) override {
+        if (!_ok) return 0;
+        if (len >= _cap) {
+            // крупные данные - напрямую, без копирования
+            if (!flush()) return 0;
+            size_t wr = _out.write(buf, len);
+            if (wr != len) _ok = false;
+            return wr;
+        }
+        if (_len + len > _cap && !flush()) return 0;
+        memcpy(_buf + _len, buf, len);
+        _len += len;
+        return len;
+    }
+
+    // записать накопленное. Вернёт false, если какая-то запись не прошла
+    bool flush() {
+        if (_len && _ok) _ok = _out.write(_buf, _len) == _len;
+        _len = 0;
+        return _ok;
+    }
+
+   private:
+    Sink& _out;
+    uint8_t* _buf;
+    size_t _cap, _len = 0;
+    bool _ok = true;
+};
+
+// чтение блоками по chunk байт, не больше len байт из источника (данные после образа не забираются)
+class BufReader : public Stream {
+   public:
+    BufReader(Source& src, size_t len, size_t chunk = DB_IO_BUF) : _src(src), _left(len) {
+        if (chunk > len) chunk = len;
+        _buf = chunk ? (uint8_t*)malloc(chunk) : nullptr;
+        _cap = _buf ? chunk : 0;
+    }
+    BufReader(const BufReader& r) = delete;
+    BufReader& operator=(const BufReader& r) = delete;
+
+    ~BufReader() {
+        free(_buf);
+    }
+
+    int available() override {
+        return (_len - _pos) + _left;
+    }
+    int read() override {
+        uint8_t b;
+        return readBytes(&b, 1) ? b : -1;
+    }
+    int peek() override {
+        if (_pos >= _len && !_fill()) return -1;
+        return _pos < _len ? _buf[_pos] : -1;
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) {
+        size_t n = 0;
+        while (n < length) {
+            if (_pos >= _len) {
+                // без буфера и для крупных данных - напрямую
+                if (length - n >= _cap) {
+                    size_t part = length - n;
+                    if (part > _left) part = _left;
+                    part = part ? _src.read(buffer + n, part) : 0;
+                    _left -= part;
+                    n += part;
+                    break;
+                }
+                if (!_fill()) break;
+            }
+            size_t part = _len - _pos;
+            if (part > length - n) part = length - n;
+            memcpy(buffer + n, _buf + _pos, part);
+            _pos += part;
+            n += part;
+        }
+        return n;
+    }
+    size_t readBytes(char* buffer, size_t length) {
+        return readBytes((uint8_t*)buffer, length);
+    }
+    size_t write(uint8_t) override {
+        return 0;
+    }
+
+   private:
+    Source& _src;
+    uint8_t* _buf;
+    size_t _cap, _left, _len = 0, _pos = 0;
+
+    bool _fill() {
+        if (!_cap || !_left) return 0;
+        _pos = 0;
+        _len = _src.read(_buf, _left < _cap ? _left : _cap);
+        _left -= _len;
+        return _len;
+    }
+};
+
+}  // namespace gdb
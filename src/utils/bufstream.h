@@ -0,0 +1,65 @@
+#pragma once
+#include <Arduino.h>
+
+#include "bufio.h"
+#include "crc.h"
+
+#ifndef DB_READ_BUF
+#define DB_READ_BUF 64
+#endif
+
+namespace gdb {
+
+// чтение из источника блоками по DB_READ_BUF байт вместо побайтовых запросов к ФС. Считает CRC32 прочитанного
+class BufStream : public Stream {
+   public:
+    BufStream() {}
+    BufStream(Source& s) : _s(&s) {}
+
+    int available() override {
+        return _len - _pos;
+    }
+    int read() override {
+        if (_pos >= _len && !_fill()) return -1;
+        return _buf[_pos++];
+    }
+    int peek() override {
+        if (_pos >= _len && !_fill()) return -1;
+        return _buf[_pos];
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) {
+        size_t n = 0;
+        while (n < length) {
+            if (_pos >= _len && !_fill()) break;
+            size_t part = _len - _pos;
+            if (part > length - n) part = length - n;
+            memcpy(buffer + n, _buf + _pos, part);
+            _pos += part;
+            n += part;
+        }
+        return n;
+    }
+    size_t readBytes(char* buffer, size_t length) {
+        return readBytes((uint8_t*)buffer, length);
+    }
+    size_t write(uint8_t) override {
+        return 0;
+    }
+
+    uint32_t crc = 0;
+
+   private:
+    Source* _s = nullptr;
+    uint8_t _buf[DB_READ_BUF];
+    uint16_t _len = 0, _pos = 0;
+
+    bool _fill() {
+        if (!_s) return 0;
+        _pos = 0;
+        _len = _s->read(_buf, DB_READ_BUF);
+        crc = crc32(crc, _buf, _len);
+        return _len;
+    }
+};
+
+}  // namespace gdb
@@ -0,0 +1,125 @@
+#pragma once
+#include <Arduino.h>
+#include <GTL.h>
+
+#include "hashmap.h"
+
+namespace gdb {
+
+// журнал изменений: номер последнего изменения каждого ключа + упорядоченный по номерам лог.
+// Хранит только изменения новее самого старого читателя (курсора, контрольной точки) - см. trim()
+class ChangeLog {
+    struct rec_t {
+        uint32_t seq;
+        uint32_t hash;
+    };
+
+   public:
+    // зафиксировать изменение ключа, вернёт его номер
+    uint32_t push(size_t hash) {
+        uint32_t seq = ++_seq;
+        if (!_last.put(hash, seq) || !_log.push(rec_t{seq, (uint32_t)(hash & DB_HASH_MASK)})) {
+            _lost = seq;
+        }
+        return seq;
+    }
+
+    // лог вырос вдвое с последней очистки - пора вызвать trim()
+    bool full() const {
+        return _log.length() > _limit;
+    }
+
+    // удалить записи, перекрытые более поздними изменениями тех же ключей, и изменения не новее floor -
+    // их уже прочитали все читатели. Позиции старше floor после этого считаются потерявшими изменения
+    void trim(uint32_t floor) {
+        size_t w = 0;
+        for (size_t r = 0; r < _log.length(); r++) {
+            rec_t rec = _log[r];
+            if (seq(rec.hash) != rec.seq) continue;
+            if (rec.seq <= floor) _last.remove(rec.hash);
+            else _log[w++] = rec;
+        }
+        while (_log.length() > w) _log.pop();
+        if (floor > _base) _base = floor;
+        _limit = w * 2 + 16;
+    }
+
+    // номер последнего изменения
+    uint32_t seq() const {
+        return _seq;
+    }
+
+    // номер последнего изменения ключа (0 если ключ не менялся после самого старого читателя)
+    uint32_t seq(size_t hash) const {
+        uint32_t* s = _last.get(hash);
+        return s ? *s : 0;
+    }
+
+    // есть изменения после позиции pos
+    bool available(uint32_t pos) const {
+        return pos < _seq;
+    }
+
+    // следующее изменение после позиции pos. Сдвигает pos, вернёт false если изменений нет
+    bool next(uint32_t& pos, size_t& hash) {
+        size_t low = 0, high = _log.length();
+        while (low < high) {
+            size_t mid = low + ((high - low) >> 1);
+            if (_log[mid].seq <= pos) low = mid + 1;
+            else high = mid;
+        }
+        for (; low < _log.length(); low++) {
+            const rec_t& r = _log[low];
+            if (seq(r.hash) != r.seq) continue;  // ключ менялся позже
+            pos = r.seq;
+            hash = r.hash;
+            return 1;
+        }
+        pos = _seq;
+        return 0;
+    }
+
+    // изменения после позиции pos могли быть потеряны из-за нехватки памяти или удалены trim()/clear()
+    bool lost(uint32_t pos) const {
+        return pos < _lost || pos < _base;
+    }
+
+    // забыть историю (номера продолжают расти). Читатели с более старой позицией получат lost()
+    void clear() {
+        _log.clear();
+        _last.clear();
+        _lost = _seq;
+        _limit = 16;
+    }
+
+    // освободить память. Читатели с более старой позицией получат lost()
+    void reset() {
+        _log.reset();
+        _last.reset();
+        _lost = _seq;
+        _limit = 16;
+    }
+
+    // обменяться содержимым
+    void swap(ChangeLog& l) noexcept {
+        gtl::stack<rec_t> t;
+        t.move(_log);
+        _log.move(l._log);
+        l._log.move(t);
+        _last.swap(l._last);
+        gtl::swap(_seq, l._seq);
+        gtl::swap(_lost, l._lost);
+        gtl::swap(_base, l._base);
+        gtl::swap(_limit, l._limit);
+    }
+
+   private:
+    gtl::stack<rec_t> _log;
+    HashMap<uint32_t> _last;
+    uint32_t _seq = 0;
+    uint32_t _lost = 0;
+    uint32_t _base = 0;  // изменения до этого номера удалены trim()
+    size_t _limit = 16;  // размер лога для следующего trim()
+};
+
+}  // namespace gdb
@@ -0,0 +1,49 @@
+#pragma once
+#include <Arduino.h>
+
+#include "block.h"
+
+namespace gdb {
+
+// вид отличия ячеек при сравнении
+enum class Diff : uint8_t {
+    Added,    // ячейка есть только во второй БД (образе)
+    Removed,  // ячейка есть только в первой БД
+    Changed,  // отличаются тип или данные
+};
+
+// ячейки совпадают по типу и данным
+inline bool blockEquals(const block_t& a, const block_t& b) {
+    if (a.typehash != b.typehash) return 0;
+    size_t size = a.size();
+    if (size != b.size()) return 0;
+    if (!size) return 1;
+    const void* pa = a.buffer();
+    const void* pb = b.buffer();
+    if (!pa || !pb) return pa == pb;
+    return !memcmp(pa, pb, size);
+}
+
+// сравнить два отсортированных массива ячеек за один проход.
+// f(const block_t* a, const block_t* b) вызывается для отличающихся ячеек, отсутствующая - nullptr.
+// eq(const block_t& a, const block_t& b) - сравнение ячеек с одним ключом
+template <typename E, typename F>
+void diffBlocks(const block_t* a, size_t alen, const block_t* b, size_t blen, E eq, F f) {
+    size_t i = 0, j = 0;
+    while (i < alen || j < blen) {
+        if (j >= blen || (i < alen && a[i].keyHash() < b[j].keyHash())) {
+            f(&a[i++], (const block_t*)nullptr);
+        } else if (i >= alen || b[j].keyHash() < a[i].keyHash()) {
+            f((const block_t*)nullptr, &b[j++]);
+        } else {
+            if (!eq(a[i], b[j])) f(&a[i], &b[j]);
+            i++, j++;
+        }
+    }
+}
+template <typename F>
+void diffBlocks(const block_t* a, size_t alen, const block_t* b, size_t blen, F f) {
+    diffBlocks(a, alen, b, blen, blockEquals, f);
+}
+
+}  // namespace gdb
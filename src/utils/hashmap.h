@@ -0,0 +1,155 @@
+#pragma once
+#include <Arduino.h>
+#include <GTL.h>
+
+#include "types.h"
+
+namespace gdb {
+
+// хэш-таблица с открытой адресацией, ключ - 29-бит хэш ключа БД. T - простой тип (копируется memcpy)
+template <typename T>
+class HashMap {
+    struct slot_t {
+        uint32_t key;
+        T val;
+    };
+
+   public:
+    HashMap() {}
+    HashMap(const HashMap& m) = delete;
+    HashMap& operator=(const HashMap& m) = delete;
+
+    ~HashMap() {
+        reset();
+    }
+
+    // указатель на значение по ключу или nullptr
+    T* get(size_t hash) const {
+        int i = _find(hash);
+        return (i < 0) ? nullptr : &_tab[i].val;
+    }
+
+    // есть ключ
+    bool has(size_t hash) const {
+        return get(hash);
+    }
+
+    // записать значение. Вернёт указатель на него или nullptr при ошибке памяти
+    T* put(size_t hash, const T& val) {
+        T* p = get(hash);
+        if (p) {
+            *p = val;
+            return p;
+        }
+        if ((_len + 1) * 2 > _cap && !_grow()) return nullptr;
+        uint32_t key = hash & DB_HASH_MASK;
+        size_t i = _index(key);
+        while (_tab[i].key != DB_MAP_EMPTY) i = (i + 1) & _mask();
+        _tab[i].key = key;
+        _tab[i].val = val;
+        _len++;
+        return &_tab[i].val;
+    }
+
+    // удалить ключ
+    bool remove(size_t hash) {
+        int found = _find(hash);
+        if (found < 0) return 0;
+        size_t i = found;
+        // сдвиг цепочки назад вместо "надгробий"
+        for (size_t j = (i + 1) & _mask(); _tab[j].key != DB_MAP_EMPTY; j = (j + 1) & _mask()) {
+            size_t home = _index(_tab[j].key);
+            if (((j - home) & _mask()) >= ((j - i) & _mask())) {
+                _tab[i] = _tab[j];
+                i = j;
+            }
+        }
+        _tab[i].key = DB_MAP_EMPTY;
+        _len--;
+        return 1;
+    }
+
+    // вызвать f(size_t hash, T& val) для всех записей
+    template <typename F>
+    void forEach(F f) {
+        for (size_t i = 0; i < _cap; i++) {
+            if (_tab[i].key != DB_MAP_EMPTY) f((size_t)_tab[i].key, _tab[i].val);
+        }
+    }
+
+    // удалить все записи
+    void clear() {
+        for (size_t i = 0; i < _cap; i++) _tab[i].key = DB_MAP_EMPTY;
+        _len = 0;
+    }
+
+    // освободить память
+    void reset() {
+        free(_tab);
+        _tab = nullptr;
+        _cap = _len = 0;
+    }
+
+    // обменяться содержимым
+    void swap(HashMap& m) noexcept {
+        gtl::swap(_tab, m._tab);
+        gtl::swap(_cap, m._cap);
+        gtl::swap(_len, m._len);
+        gtl::swap(_bits, m._bits);
+    }
+
+    // количество записей
+    size_t length() const {
+        return _len;
+    }
+
+   private:
+    static constexpr uint32_t DB_MAP_EMPTY = 0xFFFFFFFFul;
+
+    slot_t* _tab = nullptr;
+    size_t _cap = 0;
+    size_t _len = 0;
+    uint8_t _bits = 0;
+
+    inline size_t _mask() const {
+        return _cap - 1;
+    }
+
+    inline size_t _index(uint32_t key) const {
+        return (uint32_t)(key * 0x9E3779B1ul) >> (32 - _bits);
+    }
+
+    int _find(size_t hash) const {
+        if (!_len) return -1;
+        uint32_t key = hash & DB_HASH_MASK;
+        for (size_t i = _index(key);; i = (i + 1) & _mask()) {
+            if (_tab[i].key == key) return i;
+            if (_tab[i].key == DB_MAP_EMPTY) return -1;
+        }
+        return -1;
+    }
+
+    bool _grow() {
+        uint8_t bits = _bits ? _bits + 1 : 3;
+        size_t cap = (size_t)1 << bits;
+        slot_t* tab = (slot_t*)malloc(cap * sizeof(slot_t));
+        if (!tab) return 0;
+        for (size_t i = 0; i < cap; i++) tab[i].key = DB_MAP_EMPTY;
+
+        slot_t* old = _tab;
+        size_t oldcap = _cap;
+        _tab = tab;
+        _cap = cap;
+        _bits = bits;
+        for (size_t i = 0; i < oldcap; i++) {
+            if (old[i].key == DB_MAP_EMPTY) continue;
+            size_t j = _index(old[i].key);
+            while (_tab[j].key != DB_MAP_EMPTY) j = (j + 1) & _mask();
+            _tab[j] = old[i];
+        }
+        free(old);
+        return 1;
+    }
+};
+
+}  // namespace gdb
@@ -0,0 +1,589 @@
+#pragma once
+#include <Arduino.h>
+#include <StreamIO.h>
+
+#include "block.h"
+#include "bufio.h"
+#include "crc.h"
+#include "lz.h"
+#include "types.h"
+
+// формат образа v1: [db len16] [hash32, value32] [hash32, size16, data...]
+// формат образа v2: [magic32, ver8, flags8, res16, db len32] [hash32, value32] [hash32, size_hi16, size16, data...] [crc32 записей]
+// размер в v2 записан старшей половиной вперёд: [size16, data...] совпадает с данными ячейки в памяти.
+// старшая половина размера зарезервирована и равна 0 (ячейка в памяти до 64 КБ), запись с другой не загружается.
+// метка с версией не 2 - начало образа v1
+// сегменты v2: [заголовок] [first32, last32, count32, size32, crc32 записей, записи...]... [crc32 заголовков сегментов]
+// компактные записи v2: [varint разность хэша с предыдущим << 3 | тип] [varint (zigzag) числа | float32 | varint размер << 1 | lz, (varint сжатый размер), data...]
+// разность (writeDeltaTo): образ из изменённых ячеек и удалений [hash32 с типом None, 0], компактное удаление - [varint разность << 3 | 0]
+// Журнал изменений пишется записями v1
+
+// #define DB_IMAGE_V1  // писать образ в формате v1 (для чтения старыми версиями библиотеки)
+
+#define DB_IMAGE_MAGIC 0x32424447ul  // GDB2
+#define DB_IMAGE_SORTED (1 << 0)     // записи отсортированы по хэшу
+#define DB_IMAGE_COMPACT (1 << 1)    // компактные записи
+#define DB_IMAGE_LZ (1 << 2)         // строки и бинарные данные сжимаются, если это уменьшает размер
+#define DB_IMAGE_SEGMENTS (1 << 3)   // записи разбиты на независимые сегменты
+#define DB_IMAGE_DELTA (1 << 4)      // разность: изменённые ячейки и удаления, не полный образ
+
+#ifdef DB_IMAGE_V1
+#define DB_IMAGE_VER 1
+#else
+#define DB_IMAGE_VER 2
+#endif
+
+namespace gdb {
+
+// заголовок образа v2
+struct image_t {
+    uint32_t magic;
+    uint8_t ver;
+    uint8_t flags;
+    uint16_t res;
+    uint32_t len;
+};
+
+// заголовок сегмента образа v2
+struct seg_t {
+    uint32_t first;  // хэш первой записи
+    uint32_t last;   // хэш последней записи
+    uint32_t count;  // записей
+    uint32_t size;   // байт записей
+    uint32_t crc;    // CRC32 записей
+};
+
+// записать varint в буфер (до 10 байт). Вернёт размер
+inline uint8_t varintEncode(uint64_t v, uint8_t* buf) {
+    uint8_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    buf[n++] = v;
+    return n;
+}
+
+inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+inline int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// счётчик размера вместо записи
+struct SizeCounter {
+    size_t len = 0;
+
+    size_t write(const uint8_t* buf, size_t size) {
+        (void)buf;
+        len += size;
+        return size;
+    }
+};
+
+// экспортный размер записи с динамическими данными
+inline size_t dynamicSize(size_t size, uint8_t ver = 1) {
+    return 4 + (ver >= 2 ? 4 : 2) + size;
+}
+
+// экспортный размер записи (0 - запись не экспортируется)
+inline size_t recordSize(Type type, const void* buf, size_t size, uint8_t ver = 1) {
+    if (type == Type::None) return 0;
+    if (Converter::isDynamic(type)) return buf ? dynamicSize(size, ver) : 0;
+    return 4 + 4;
+}
+
+// записать запись. Вернёт количество записанных байт
+template <typename T>
+size_t writeRecord(T& writer, Type type, size_t hash, const void* buf, size_t size, uint8_t ver = 1) {
+    if (!recordSize(type, buf, size)) return 0;
+    size_t wr = 0;
+    uint32_t typehash = DB_MAKE_TYPEHASH(type, hash);
+    wr += writer.write((uint8_t*)&typehash, 4);
+    if (Converter::isDynamic(type)) {
+        // v2: старшая половина длины зарезервирована и всегда 0 - ячейка в памяти до 64 КБ
+        uint16_t len[2] = {0, (uint16_t)size};
+        if (ver >= 2) wr += writer.write((uint8_t*)len, 4);
+        else wr += writer.write((uint8_t*)&len[1], 2);
+        wr += writer.write((uint8_t*)buf, size);
+    } else {
+        uint32_t data = 0;
+        memcpy(&data, buf, 4);
+        wr += writer.write((uint8_t*)&data, 4);
+    }
+    return wr;
+}
+
+template <typename T>
+size_t writeRecord(T& writer, const block_t& b, uint8_t ver = 1) {
+    return writeRecord(writer, b.type(), b.keyHash(), b.buffer(), b.size(), ver);
+}
+
+// записать запись об удалении ячейки: тип None, пустые данные
+template <typename T>
+size_t writeTombstone(T& writer, size_t hash) {
+    uint32_t rec[2] = {(uint32_t)DB_MAKE_TYPEHASH(Type::None, hash), 0};
+    return writer.write((uint8_t*)rec, 8);
+}
+
+// запись образа по записям за один проход: CRC считается по ходу и дописывается в конец
+template <typename T>
+class ImageWriter {
+   public:
+    ImageWriter() {}
+    ImageWriter(T& writer) : _w(&writer) {}
+
+    // сменить приёмник, не прерывая образ (напр. новый буфер на каждую часть записи)
+    void use(T& writer) {
+        _w = &writer;
+    }
+
+    // записать заголовок образа из len записей. mode - DB_IMAGE_COMPACT, DB_IMAGE_LZ, DB_IMAGE_DELTA (только для v2)
+    bool begin(size_t len, bool sorted = true, uint8_t mode = 0) {
+        start(mode);
+#if DB_IMAGE_VER >= 2
+        image_t h{DB_IMAGE_MAGIC, DB_IMAGE_VER, (uint8_t)((sorted ? DB_IMAGE_SORTED : 0) | _mode | (mode & DB_IMAGE_DELTA)), 0, (uint32_t)len};
+        _write(&h, sizeof(h), false);
+#else
+        (void)sorted;
+        uint16_t len16 = len;
+        _write(&len16, 2, false);
+#endif
+        return _ok;
+    }
+
+    // начать записи без заголовка образа (сегмент): CRC и размер считаются заново
+    void start(uint8_t mode = 0) {
+        crc = 0;
+        written = 0;
+        _ok = true;
+        _prev = 0;
+        _mode = (DB_IMAGE_VER >= 2 && (mode & DB_IMAGE_COMPACT)) ? (mode & (DB_IMAGE_COMPACT | DB_IMAGE_LZ)) : 0;
+    }
+
+    // записать запись целиком. Пустые записи пропускаются
+    bool record(Type type, size_t hash, const void* buf, size_t size) {
+        if (!recordSize(type, buf, size)) return _ok;
+        if (_mode) return _compact(type, hash, (const uint8_t*)buf, size);
+        if (!Converter::isDynamic(type)) {
+            uint32_t rec[2] = {(uint32_t)DB_MAKE_TYPEHASH(type, hash), 0};
+            memcpy(&rec[1], buf, 4);
+            _write(rec, 8);
+            return _ok;
+        }
+        head(DB_MAKE_TYPEHASH(type, hash), size);
+        return data(buf, size);
+    }
+    bool record(const block_t& b) {
+        return record(b.type(), b.keyHash(), b.buffer(), b.size());
+    }
+
+    // записать удаление ячейки (в разности)
+    bool tombstone(size_t hash) {
+        if (_mode) {
+            uint32_t delta = (uint32_t)(hash & DB_HASH_MASK) - _prev;
+            _prev = hash & DB_HASH_MASK;
+            _varint((uint64_t)delta << DB_TYPE_SIZE);
+            return _ok;
+        }
+        uint32_t rec[2] = {(uint32_t)DB_MAKE_TYPEHASH(Type::None, hash), 0};
+        _write(rec, 8);
+        return _ok;
+    }
+
+    // записать начало записи с динамическими данными, сами данные - через data(). Только для некомпактного образа
+    bool head(uint32_t typehash, size_t size) {
+        _write(&typehash, 4);
+        uint16_t len[2] = {0, (uint16_t)size};  // старшая половина зарезервирована
+        if (DB_IMAGE_VER >= 2) _write(len, 4);
+        else _write(&len[1], 2);
+        return _ok;
+    }
+
+    // записать часть данных записи
+    bool data(const void* buf, size_t len) {
+        _write(buf, len);
+        return _ok;
+    }
+
+    // закончить образ. Вернёт false, если какая-то часть не записалась
+    bool end() {
+        if (DB_IMAGE_VER >= 2) {
+            uint32_t c = crc;
+            _write(&c, 4, false);
+        }
+        return _ok;
+    }
+
+    uint32_t crc = 0;
+    size_t written = 0;
+
+   private:
+    T* _w = nullptr;
+    uint32_t _prev = 0;
+    uint8_t _mode = 0;
+    bool _ok = true;
+
+    void _write(const void* buf, size_t len, bool sum = true) {
+        if (!len) return;
+        size_t wr = _w->write((uint8_t*)buf, len);
+        if (sum && DB_IMAGE_VER >= 2) crc = crc32(crc, buf, wr);
+        written += wr;
+        if (wr != len) _ok = false;
+    }
+
+    void _varint(uint64_t v) {
+        uint8_t buf[10];
+        _write(buf, varintEncode(v, buf));
+    }
+
+    // компактная запись
+    bool _compact(Type type, size_t hash, const uint8_t* buf, size_t size) {
+        // разность по модулю 2^32 - читается и для неотсортированного образа
+        uint32_t delta = (uint32_t)(hash & DB_HASH_MASK) - _prev;
+        _prev = hash & DB_HASH_MASK;
+        _varint(((uint64_t)delta << DB_TYPE_SIZE) | ((uint32_t)type >> DB_HASH_SIZE));
+
+        switch (type) {
+            case Type::Int: {
+                int32_t v;
+                memcpy(&v, buf, 4);
+                _varint(zigzag(v));
+            } break;
+
+            case Type::Uint: {
+                uint32_t v;
+                memcpy(&v, buf, 4);
+                _varint(v);
+            } break;
+
+            case Type::Int64:
+            case Type::Uint64: {
+                uint64_t v;
+                memcpy(&v, buf, 8);
+                _varint(type == Type::Int64 ? zigzag((int64_t)v) : v);
+            } break;
+
+            case Type::Float:
+                _write(buf, 4);
+                break;
+
+            default: {
+                // данные сжимаются дважды: размер, затем запись - без буфера под результат
+                size_t lz = (_mode & DB_IMAGE_LZ) ? lzEncode(buf, size, [](uint8_t) {}) : size;
+                if (lz >= size) {
+                    _varint((uint64_t)size << 1);
+                    _write(buf, size);
+                    break;
+                }
+                _varint(((uint64_t)size << 1) | 1);
+                _varint(lz);
+                uint8_t chunk[32];
+                uint8_t n = 0;
+                lzEncode(buf, size, [&](uint8_t b) {
+                    chunk[n++] = b;
+                    if (n == sizeof(chunk)) {
+                        _write(chunk, n);
+                        n = 0;
+                    }
+                });
+                _write(chunk, n);
+            } break;
+        }
+        return _ok;
+    }
+};
+
+// записать образ из массива блоков напрямую (напр. в память)
+template <typename T>
+bool writeImageRaw(T& writer, const block_t* blocks, size_t len, uint8_t mode = 0) {
+    ImageWriter<T> img(writer);
+    img.begin(len, true, mode);
+    for (size_t i = 0; i < len; i++) img.record(blocks[i]);
+    return img.end();
+}
+
+// записать образ из массива блоков: поля собираются в блоки по DB_IO_BUF байт
+template <typename T>
+bool writeImage(T& writer, const block_t* blocks, size_t len, uint8_t mode = 0) {
+    WriterSink<T> sink(writer);
+    BufWriter buf(sink);
+    bool ok = writeImageRaw(buf, blocks, len, mode);
+    return buf.flush() && ok;
+}
+
+// экспортный размер образа из массива блоков. Компактный образ для этого кодируется вхолостую
+inline size_t imageSize(const block_t* blocks, size_t len, uint8_t mode = 0) {
+    if (DB_IMAGE_VER >= 2 && (mode & DB_IMAGE_COMPACT)) {
+        SizeCounter cnt;
+        writeImageRaw(cnt, blocks, len, mode);
+        return cnt.len;
+    }
+    size_t sz = (DB_IMAGE_VER >= 2) ? (sizeof(image_t) + 4) : 2;  // заголовок, CRC
+    for (size_t i = 0; i < len; i++) {
+        sz += recordSize(blocks[i].type(), blocks[i].buffer(), blocks[i].size(), DB_IMAGE_VER);
+    }
+    return sz;
+}
+
+// разобрать заголовок образа из первых байт (до sizeof(image_t)). Вернёт размер заголовка или 0 при ошибке
+inline uint8_t imageHeader(const uint8_t* buf, size_t len, uint8_t& ver, uint8_t& flags, uint32_t& count) {
+    image_t h;
+    if (len >= sizeof(h)) {
+        memcpy(&h, buf, sizeof(h));
+        // метка без версии 2 - образ v1, у которого количество и начало первой записи совпали с меткой
+        if (h.magic == DB_IMAGE_MAGIC && h.ver == 2) {
+            ver = 2;
+            flags = h.flags;
+            count = h.len;
+            return sizeof(h);
+        }
+    }
+    if (len < 2) return 0;
+    uint16_t len16;
+    memcpy(&len16, buf, 2);
+    ver = 1;
+    flags = DB_IMAGE_SORTED;
+    count = len16;
+    return 2;
+}
+
+// прочитать запись в пустой блок, динамические данные выделяются в памяти.
+// typehash - уже прочитанное начало записи
+inline bool readRecord(Reader& reader, block_t& block, uint8_t ver, uint32_t typehash) {
+    block.typehash = typehash;
+    if (block.isDynamic()) {
+        uint16_t size;
+        if (ver >= 2) {
+            // старшая половина длины зарезервирована: в памяти ячейки до 64 КБ
+            uint16_t hi;
+            if (!reader.read(hi) || hi) return 0;
+        }
+        if (!reader.read(size)) return 0;
+        if (!block.reserve(size)) return 0;
+        if (!reader.read(block.buffer(), size)) {
+            block.reset();
+            return 0;
+        }
+        block.setSize(size);
+    } else {
+        uint32_t data;
+        if (!reader.read(data)) return 0;
+        block.data = data;
+    }
+    return 1;
+}
+
+inline bool readRecord(Reader& reader, block_t& block, uint8_t ver = 1) {
+    uint32_t typehash;
+    if (!reader.read(typehash)) return 0;
+    return readRecord(reader, block, ver, typehash);
+}
+
+// чтение образа v1 или v2 по записям с проверкой CRC
+class ImageReader {
+   public:
+    // прочитать заголовок. Вернёт false при ошибке формата
+    bool begin(Reader& reader) {
+        crc = _hcrc = 0;
+        _n = _seg = 0;
+        _prev = 0;
+        _pend = 0;
+        uint16_t lo;
+        if (!reader.read(lo)) return 0;
+        ver = 1;
+        flags = DB_IMAGE_SORTED;
+        len = lo;
+        if (lo != (DB_IMAGE_MAGIC & 0xffff) || reader.available() < (int)sizeof(image_t) - 2) return 1;
+        // образ v1, количество совпало с началом метки: прочитанные байты - начало первой записи
+        image_t h;
+        if (!reader.read(_pbuf, 2)) return 0;
+        _pend = 2;
+        if (_pbuf[0] != (uint8_t)(DB_IMAGE_MAGIC >> 16) || _pbuf[1] != (uint8_t)(DB_IMAGE_MAGIC >> 24)) return 1;
+        if (!reader.read(_pbuf[2])) return 0;
+        _pend = 3;
+        if (_pbuf[2] != 2) return 1;
+        if (!reader.read((uint8_t*)&h + 5, sizeof(h) - 5)) return 0;
+        _pend = 0;
+        ver = 2;
+        flags = h.flags;
+        len = h.len;
+        return 1;
+    }
+
+    // начать чтение записей одного сегмента (без заголовков). flags - флаги образа
+    void segment(uint8_t imgFlags, uint32_t count) {
+        ver = 2;
+        flags = imgFlags & ~DB_IMAGE_SEGMENTS;
+        len = count;
+        crc = _hcrc = 0;
+        _n = _seg = 0;
+        _prev = 0;
+        _pend = 0;
+    }
+
+    // в образе есть ещё записи
+    bool available(Reader& reader) {
+        return (ver >= 2) ? (_n < len) : (_pend || reader.available());
+    }
+
+    // прочитать следующую запись в пустой блок
+    bool next(Reader& reader, block_t& block) {
+        // начало сегмента: записи считаются заново
+        while ((flags & DB_IMAGE_SEGMENTS) && !_seg) {
+            seg_t h;
+            if (!reader.read(h)) return 0;
+            _hcrc = crc32(_hcrc, &h, sizeof(h));
+            _seg = h.count;
+            _segCrc = h.crc;
+            _segFirst = h.first;
+            _segLast = h.last;
+            _segStart = true;
+            crc = 0;
+            _prev = 0;
+        }
+        if (!_next(reader, block)) return 0;
+        if (flags & DB_IMAGE_SEGMENTS) {
+            // отсортированный сегмент: ключи по возрастанию без повторов от first до last из заголовка
+            uint32_t key = block.keyHash();
+            bool bad = (flags & DB_IMAGE_SORTED) && (_segStart ? key != _segFirst : key <= _segKey);
+            _segKey = key;
+            _segStart = false;
+            if (!--_seg) bad |= crc != _segCrc || ((flags & DB_IMAGE_SORTED) && key != _segLast);
+            if (bad) {
+                block.reset();
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    // дочитать образ и проверить CRC (у v1 нет). У сегментов в конце CRC их заголовков
+    bool end(Reader& reader) {
+        if (ver < 2) return 1;
+        uint32_t c;
+        return reader.read(c) && c == ((flags & DB_IMAGE_SEGMENTS) ? _hcrc : crc);
+    }
+
+    uint8_t ver = 1, flags = 0;
+    uint32_t len = 0, crc = 0;
+
+   private:
+    uint32_t _n = 0, _prev = 0, _seg = 0, _segCrc = 0, _hcrc = 0;
+    uint32_t _segFirst = 0, _segLast = 0, _segKey = 0;
+    uint8_t _pbuf[3], _pend = 0;  // прочитанное в begin() начало первой записи v1
+    bool _segStart = false;
+
+    bool _next(Reader& reader, block_t& block) {
+        if (flags & DB_IMAGE_COMPACT) {
+            if (!_compact(reader, block)) {
+                block.reset();
+                return 0;
+            }
+            _n++;
+            return 1;
+        }
+        uint32_t typehash;
+        if (_pend) {
+            memcpy(&typehash, _pbuf, _pend);
+            if (!reader.read((uint8_t*)&typehash + _pend, 4 - _pend)) return 0;
+            _pend = 0;
+        } else if (!reader.read(typehash)) {
+            return 0;
+        }
+        if (!readRecord(reader, block, ver, typehash)) return 0;
+        _n++;
+        if (ver >= 2) {
+            crc = crc32(crc, &block.typehash, 4);
+            if (block.isDynamic()) {
+                uint16_t len[2] = {0, (uint16_t)block.size()};
+                crc = crc32(crc, len, 4);
+                crc = crc32(crc, block.buffer(), block.size());
+            } else {
+                crc = crc32(crc, &block.data, 4);
+            }
+        }
+        return 1;
+    }
+
+    // прочитать с подсчётом CRC
+    bool _get(Reader& reader, void* buf, size_t len) {
+        if (!reader.read(buf, len)) return 0;
+        crc = crc32(crc, buf, len);
+        return 1;
+    }
+
+    bool _varint(Reader& reader, uint64_t& v) {
+        v = 0;
+        for (uint8_t shift = 0; shift < 64; shift += 7) {
+            uint8_t b;
+            if (!_get(reader, &b, 1)) return 0;
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return 1;
+        }
+        return 0;
+    }
+
+    // компактная запись
+    bool _compact(Reader& reader, block_t& block) {
+        uint64_t v;
+        if (!_varint(reader, v)) return 0;
+        _prev += (uint32_t)(v >> DB_TYPE_SIZE);
+        Type type = (Type)((uint32_t)(v & ((1 << DB_TYPE_SIZE) - 1)) << DB_HASH_SIZE);
+        block.typehash = DB_MAKE_TYPEHASH(type, _prev);
+
+        switch (type) {
+            case Type::Int:
+            case Type::Uint: {
+                if (!_varint(reader, v)) return 0;
+                uint32_t data = (type == Type::Int) ? (uint32_t)unzigzag(v) : (uint32_t)v;
+                block.data = data;
+            } break;
+
+            case Type::Float: {
+                uint32_t data;
+                if (!_get(reader, &data, 4)) return 0;
+                block.data = data;
+            } break;
+
+            case Type::Int64:
+            case Type::Uint64: {
+                if (!_varint(reader, v) || !block.isDynamic() || !block.reserve(8)) return 0;
+                if (type == Type::Int64) v = unzigzag(v);
+                memcpy(block.buffer(), &v, 8);
+                block.setSize(8);
+            } break;
+
+            case Type::String:
+            case Type::Bin: {
+                if (!_varint(reader, v) || (v >> 1) > 0xffff) return 0;
+                uint16_t size = v >> 1;
+                if (!block.reserve(size)) return 0;
+                if (v & 1) {
+                    uint64_t lz;
+                    if (!_varint(reader, lz)) return 0;
+                    bool ok = lzDecode((uint8_t*)block.buffer(), size, [&](uint8_t& b) {
+                        return lz-- && _get(reader, &b, 1);
+                    });
+                    if (!ok || lz) return 0;
+                } else if (!_get(reader, block.buffer(), size)) {
+                    return 0;
+                }
+                block.setSize(size);
+            } break;
+
+            case Type::None:
+                // удаление - только в разности
+                if (!(flags & DB_IMAGE_DELTA)) return 0;
+                block.data = 0;
+                break;
+
+            default:
+                return 0;
+        }
+        return 1;
+    }
+};
+
+}  // namespace gdb
@@ -0,0 +1,80 @@
+#pragma once
+#include <Arduino.h>
+
+// быстрое LZ-сжатие данных до 64 КБ: [0lllllll, литералы (l + 1)...] или [1mmmmmmm, смещение16] - повтор (m + 4) байт
+
+#ifndef DB_LZ_BITS
+#define DB_LZ_BITS 8  // размер таблицы поиска повторов: 2^bits * 2 байт на стеке
+#endif
+
+namespace gdb {
+
+// сжать len байт, put(uint8_t) вызывается для каждого байта результата. Вернёт размер результата
+template <typename F>
+size_t lzEncode(const uint8_t* src, size_t len, F put) {
+    uint16_t table[1 << DB_LZ_BITS];
+    memset(table, 0, sizeof(table));
+    size_t out = 0, i = 0, lit = 0;
+
+    // выдать литералы до end
+    auto literals = [&](size_t end) {
+        while (lit < end) {
+            size_t n = end - lit;
+            if (n > 128) n = 128;
+            put((uint8_t)(n - 1));
+            for (size_t k = 0; k < n; k++) put(src[lit++]);
+            out += 1 + n;
+        }
+    };
+
+    while (i + 4 <= len) {
+        uint32_t v;
+        memcpy(&v, src + i, 4);
+        uint16_t& slot = table[(uint32_t)(v * 2654435761ul) >> (32 - DB_LZ_BITS)];
+        size_t ref = slot;  // позиция + 1, 0 - пусто
+        slot = i + 1;
+        if (!ref-- || i - ref > 0xffff || memcmp(src + ref, src + i, 4)) {
+            i++;
+            continue;
+        }
+        size_t m = 4;
+        while (i + m < len && m < 131 && src[ref + m] == src[i + m]) m++;
+        literals(i);
+        uint16_t off = i - ref;
+        put((uint8_t)(0x80 | (m - 4)));
+        put((uint8_t)off);
+        put((uint8_t)(off >> 8));
+        out += 3;
+        i += m;
+        lit = i;
+    }
+    literals(len);
+    return out;
+}
+
+// распаковать в буфер из len байт, get(uint8_t&) читает следующий байт сжатых данных
+template <typename F>
+bool lzDecode(uint8_t* dst, size_t len, F get) {
+    size_t o = 0;
+    while (o < len) {
+        uint8_t c;
+        if (!get(c)) return 0;
+        if (c < 0x80) {
+            size_t n = c + 1;
+            if (o + n > len) return 0;
+            while (n--) {
+                if (!get(dst[o++])) return 0;
+            }
+        } else {
+            uint8_t lo, hi;
+            if (!get(lo) || !get(hi)) return 0;
+            size_t off = lo | (hi << 8), n = (c & 0x7f) + 4;
+            if (!off || off > o || o + n > len) return 0;
+            // побайтно: повтор может перекрывать сам себя
+            for (; n; n--, o++) dst[o] = dst[o - off];
+        }
+    }
+    return 1;
+}
+
+}  // namespace gdb
@@ -0,0 +1,146 @@
+#pragma once
+#include <Arduino.h>
+#include <GTL.h>
+
+#include "block.h"
+#include "crc.h"
+
+#define DB_MERKLE_MAX 16  // максимальная глубина дерева хэшей (65536 листьев, 512 КБ)
+
+namespace gdb {
+
+// дерево хэшей (Merkle) над пространством хэшей ключей: 2^depth листьев, лист - диапазон ключей с одинаковыми старшими битами.
+// Узлы хранятся массивом: узел idx уровня level - [(1 << level) + idx], корень - [1]. Изменение ключа помечает лист,
+// лист и путь до корня пересчитываются при следующем чтении
+class Merkle {
+   public:
+    Merkle() {}
+    Merkle(const Merkle& m) = delete;
+    Merkle& operator=(const Merkle& m) = delete;
+
+    ~Merkle() {
+        reset();
+    }
+
+    // создать дерево глубины depth (0 - удалить). Все листья помечены для пересчёта
+    bool begin(uint8_t depth) {
+        reset();
+        if (!depth) return 1;
+        if (depth > DB_MERKLE_MAX) depth = DB_MERKLE_MAX;
+        uint32_t leaves = 1ul << depth;
+        _nodes = (uint32_t*)calloc(leaves * 2, 4);
+        _dirty = (uint8_t*)malloc((leaves + 7) / 8);
+        if (!_nodes || !_dirty) {
+            reset();
+            return 0;
+        }
+        memset(_dirty, 0xff, (leaves + 7) / 8);
+        _depth = depth;
+        _stale = true;
+        return 1;
+    }
+
+    // освободить память
+    void reset() {
+        free(_nodes);
+        free(_dirty);
+        _nodes = nullptr;
+        _dirty = nullptr;
+        _depth = 0;
+        _stale = false;
+    }
+
+    bool valid() const {
+        return _nodes;
+    }
+
+    uint8_t depth() const {
+        return _depth;
+    }
+
+    // лист ключа
+    uint32_t leaf(size_t hash) const {
+        return (uint32_t)(hash & DB_HASH_MASK) >> (DB_HASH_SIZE - _depth);
+    }
+
+    // диапазон хэшей ключей узла [from, to]
+    void range(uint8_t level, uint32_t idx, size_t& from, size_t& to) const {
+        uint8_t shift = DB_HASH_SIZE - level;
+        from = (size_t)idx << shift;
+        to = from + (((size_t)1 << shift) - 1);
+    }
+
+    // ключ изменён - лист пересчитается
+    void touch(size_t hash) {
+        if (!_nodes) return;
+        uint32_t l = leaf(hash);
+        _dirty[l >> 3] |= 1 << (l & 7);
+        _stale = true;
+    }
+
+    // пересчитать помеченные листья и их пути до корня. leafHash(uint32_t leaf) - хэш ячеек листа (0 - пустой)
+    template <typename F>
+    void update(F leafHash) {
+        if (!_stale) return;
+        uint32_t leaves = 1ul << _depth;
+        for (uint32_t l = 0; l < leaves; l += 8) {
+            if (!_dirty[l >> 3]) continue;
+            for (uint32_t k = l; k < l + 8 && k < leaves; k++) {
+                if (!(_dirty[k >> 3] & (1 << (k & 7)))) continue;
+                uint32_t i = leaves + k;
+                _nodes[i] = leafHash(k);
+                while (i > 1) {
+                    i >>= 1;
+                    _nodes[i] = join(_nodes[i * 2], _nodes[i * 2 + 1]);
+                }
+            }
+            _dirty[l >> 3] = 0;
+        }
+        _stale = false;
+    }
+
+    // хэш узла. Вызывать после update()
+    uint32_t node(uint8_t level, uint32_t idx) const {
+        return _nodes[(1ul << level) + idx];
+    }
+
+    // хэши узлов уровня подряд (2^level значений)
+    const uint32_t* level(uint8_t level) const {
+        return _nodes + (1ul << level);
+    }
+
+    // хэш ячейки: тип, ключ и данные
+    static uint32_t cell(uint32_t crc, const block_t& b) {
+        crc = crc32(crc, &b.typehash, 4);
+        if (b.isDynamic()) {
+            uint16_t size = b.size();
+            crc = crc32(crc, &size, 2);
+            return b.buffer() ? crc32(crc, b.buffer(), size) : crc;
+        }
+        uint32_t data = b.data;
+        return crc32(crc, &data, 4);
+    }
+
+    // хэш узла из хэшей потомков. Пустое поддерево - 0
+    static uint32_t join(uint32_t left, uint32_t right) {
+        if (!left && !right) return 0;
+        uint32_t pair[2] = {left, right};
+        return crc32(0, pair, 8);
+    }
+
+    // обменяться содержимым
+    void swap(Merkle& m) noexcept {
+        gtl::swap(_nodes, m._nodes);
+        gtl::swap(_dirty, m._dirty);
+        gtl::swap(_depth, m._depth);
+        gtl::swap(_stale, m._stale);
+    }
+
+   private:
+    uint32_t* _nodes = nullptr;
+    uint8_t* _dirty = nullptr;  // битовая маска листьев для пересчёта
+    uint8_t _depth = 0;
+    bool _stale = false;
+};
+
+}  // namespace gdb
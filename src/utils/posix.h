@@ -0,0 +1,332 @@
+#pragma once
+#include <Arduino.h>
+#include <GTL.h>
+
+#include "rwlock.h"
+#include "storage.h"
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(ESP32) && !defined(ESP_PLATFORM)
+#define DB_USE_POSIX
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef DB_POSIX_BUF
+#define DB_POSIX_BUF 65536  // буфер записи файла в байтах, кратен 4096
+#endif
+
+#define DB_POSIX_ALIGN 4096  // выравнивание прямой записи мимо кэша ОС
+
+namespace gdb {
+
+// запись файлов на носитель
+enum class Sync : uint8_t {
+    None,  // не синхронизировать, данные остаются в кэше ОС
+    Data,  // fdatasync: данные и размер файла
+    Full,  // fsync: данные и все метаданные
+};
+
+class PosixStorage;
+
+// файл POSIX: запись через буфер DB_POSIX_BUF байт с pwrite, чтение pread
+class PosixFile : public StorageFile {
+   public:
+    PosixFile(PosixStorage* st, int fd, int dfd, bool write) : _st(st), _fd(fd), _dfd(dfd), _wr(write) {
+        struct stat s;
+        _size = fstat(fd, &s) ? 0 : s.st_size;
+    }
+    PosixFile(const PosixFile& f) = delete;
+    PosixFile& operator=(const PosixFile& f) = delete;
+
+    ~PosixFile() {
+        close();
+    }
+
+    size_t read(uint8_t* buf, size_t len) override {
+        if (_fd < 0 || !_flush()) return 0;
+        size_t n = 0;
+        while (n < len) {
+            ssize_t r = pread(_fd, buf + n, len - n, _pos + n);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;
+            n += r;
+        }
+        _pos += n;
+        return n;
+    }
+
+    size_t write(const uint8_t* buf, size_t len) override {
+        if (_fd < 0 || !_wr || !_ok) return 0;
+        if (!_buf && posix_memalign((void**)&_buf, DB_POSIX_ALIGN, DB_POSIX_BUF)) _buf = nullptr;
+        if (!_buf) {
+            // без памяти под буфер - напрямую
+            if (!_pwrite(_fd, buf, len, _pos)) return 0;
+            _seekEnd(len);
+            return len;
+        }
+        // буфер копит только подряд идущие данные
+        if (_blen && _boff + _blen != _pos && !_flush()) return 0;
+        if (!_blen) _boff = _pos;
+        size_t n = 0;
+        while (n < len) {
+            size_t part = DB_POSIX_BUF - _blen;
+            if (part > len - n) part = len - n;
+            memcpy(_buf + _blen, buf + n, part);
+            _blen += part;
+            n += part;
+            if (_blen == DB_POSIX_BUF && !_flush()) return 0;
+            if (!_blen) _boff = _pos + n;
+        }
+        _seekEnd(len);
+        return len;
+    }
+
+    bool seek(size_t pos) override {
+        if (_fd < 0) return 0;
+        _pos = pos;
+        return 1;
+    }
+    size_t position() override {
+        return _pos;
+    }
+    size_t size() override {
+        return _size;
+    }
+
+    bool close() override;
+
+   private:
+    PosixStorage* _st;
+    int _fd, _dfd;
+    bool _wr, _ok = true, _dirty = false;
+    uint8_t* _buf = nullptr;
+    size_t _pos = 0, _size = 0, _boff = 0, _blen = 0;
+
+    void _seekEnd(size_t len) {
+        _pos += len;
+        if (_pos > _size) _size = _pos;
+        _dirty = true;
+    }
+
+    // записать буфер. Целые выровненные блоки - мимо кэша ОС, если включено
+    bool _flush() {
+        if (!_blen) return _ok;
+        size_t direct = 0;
+        if (_dfd >= 0 && !(_boff % DB_POSIX_ALIGN)) direct = _blen & ~(size_t)(DB_POSIX_ALIGN - 1);
+        if (direct) _ok = _pwrite(_dfd, _buf, direct, _boff);
+        if (_ok && direct < _blen) _ok = _pwrite(_fd, _buf + direct, _blen - direct, _boff + direct);
+        _blen = 0;
+        return _ok;
+    }
+
+    static bool _pwrite(int fd, const uint8_t* buf, size_t len, size_t off) {
+        while (len) {
+            ssize_t w = pwrite(fd, buf, len, off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return 0;
+            buf += w;
+            off += w;
+            len -= w;
+        }
+        return 1;
+    }
+};
+
+// хранилище на файлах POSIX (Linux, macOS) для запуска БД на ПК и сервере.
+// Синхронизация с носителем при закрытии записанного файла, в режиме группы - одна на все файлы за group мс
+class PosixStorage : public Storage {
+    friend class PosixFile;
+
+   public:
+    // dir - папка, к которой добавляются пути файлов БД (умолч. пути как есть)
+    PosixStorage(const char* dir = nullptr) : _dir(dir ? dir : "") {
+#ifdef DB_USE_PTHREAD
+        pthread_mutex_init(&_mutex, nullptr);
+#endif
+    }
+    PosixStorage(const PosixStorage& s) = delete;
+    PosixStorage& operator=(const PosixStorage& s) = delete;
+
+    ~PosixStorage() {
+        sync();
+#ifdef DB_USE_PTHREAD
+        pthread_mutex_destroy(&_mutex);
+#endif
+    }
+
+    // синхронизация с носителем (умолч. Sync::None). group - объединять синхронизации за group мс в одну
+    // (групповая фиксация: данные закрытых файлов записываются в tick() или sync(), умолч. 0 - сразу при закрытии)
+    void setSync(Sync mode, uint32_t group = 0) {
+        sync();
+        _mode = mode;
+        _group = group;
+    }
+
+    // прямая запись файлов образа ("w") мимо кэша ОС: O_DIRECT (Linux), F_NOCACHE (macOS) (умолч. выкл)
+    void useDirect(bool direct) {
+        _direct = direct;
+    }
+
+    // подсказки ОС: последовательное чтение файлов, освобождение кэша записанных образов (умолч. выкл)
+    void useAdvise(bool advise) {
+        _advise = advise;
+    }
+
+    // количество синхронизаций с носителем
+    uint32_t syncCount() {
+        return _syncs;
+    }
+
+    StorageFile* open(const char* path, const char* mode) override {
+        String p = _dir + path;
+        bool wr = mode[0] == 'w' || mode[0] == 'a';
+        int flags = O_CLOEXEC | (wr ? O_RDWR | O_CREAT : O_RDONLY);
+        if (mode[0] == 'w') flags |= O_TRUNC;
+        int fd = ::open(p.c_str(), flags, 0644);
+        if (fd < 0) return nullptr;
+
+        int dfd = -1;
+        if (_direct && mode[0] == 'w') {
+#if defined(O_DIRECT)
+            // не все ФС поддерживают O_DIRECT (напр. tmpfs) - тогда обычная запись
+            dfd = ::open(p.c_str(), O_WRONLY | O_CLOEXEC | O_DIRECT);
+#elif defined(F_NOCACHE)
+            fcntl(fd, F_NOCACHE, 1);
+#endif
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        if (_advise && !wr) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        PosixFile* f = new PosixFile(this, fd, dfd, wr);
+        if (mode[0] == 'a') f->seek(f->size());
+        return f;
+    }
+
+    bool exists(const char* path) override {
+        struct stat s;
+        return !stat((_dir + path).c_str(), &s);
+    }
+
+    bool remove(const char* path) override {
+        return !unlink((_dir + path).c_str());
+    }
+
+    // атомарная замена: данные файла записываются на носитель до переименования, папка - после
+    bool rename(const char* from, const char* to) override {
+        String dst = _dir + to;
+        if (_mode != Sync::None && !sync()) return 0;
+        if (::rename((_dir + from).c_str(), dst.c_str())) return 0;
+        if (_mode == Sync::None) return 1;
+        int slash = dst.lastIndexOf('/');
+        String dir = (slash > 0) ? dst.substring(0, slash) : String(slash ? "." : "/");
+        int fd = ::open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return 0;
+        // каталог синхронизируется сразу и в режиме группы: после возврата замена файла переживёт сбой питания
+        _lock();
+        _syncs++;
+        bool ok = !fsync(fd);
+        _unlock();
+        return !::close(fd) && ok;
+    }
+
+    // записать на носитель данные закрытых файлов, ожидающие группы
+    bool sync() override {
+        _lock();
+        bool ok = true;
+        for (size_t i = 0; i < _pending.length(); i++) {
+            ok &= _sync(_pending[i]);
+            ::close(_pending[i]);
+        }
+        _pending.reset();
+        _unlock();
+        return ok;
+    }
+
+    void tick() override {
+        _lock();
+        bool due = _pending.length() && millis() - _since >= _group;
+        _unlock();
+        if (due) sync();
+    }
+
+   private:
+    String _dir;
+    gtl::stack<int> _pending;  // записанные файлы, ожидающие синхронизации
+    uint32_t _group = 0, _since = 0, _syncs = 0;
+    Sync _mode = Sync::None;
+    bool _direct = false, _advise = false;
+#ifdef DB_USE_PTHREAD
+    pthread_mutex_t _mutex;  // файлы закрываются и в потоке фоновой записи
+#endif
+
+    void _lock() {
+#ifdef DB_USE_PTHREAD
+        pthread_mutex_lock(&_mutex);
+#endif
+    }
+    void _unlock() {
+#ifdef DB_USE_PTHREAD
+        pthread_mutex_unlock(&_mutex);
+#endif
+    }
+
+    bool _sync(int fd) {
+        _syncs++;
+#if defined(__APPLE__)
+        return !fsync(fd);
+#else
+        return !(_mode == Sync::Full ? fsync(fd) : fdatasync(fd));
+#endif
+    }
+
+    // файл закрыт: синхронизировать сразу или добавить в группу. Забирает fd
+    bool _closed(int fd, bool dirty) {
+        if (!dirty || _mode == Sync::None) return !::close(fd);
+        if (!_group) {
+            _lock();
+            bool ok = _sync(fd);
+            _unlock();
+            return !::close(fd) && ok;
+        }
+        _lock();
+        // файл уже в группе (напр. журнал дописан повторно) - одна синхронизация на файл
+        struct stat s, ps;
+        bool dup = false;
+        if (!fstat(fd, &s)) {
+            for (size_t i = 0; i < _pending.length() && !dup; i++) {
+                dup = !fstat(_pending[i], &ps) && ps.st_dev == s.st_dev && ps.st_ino == s.st_ino;
+            }
+        }
+        if (!_pending.length()) _since = millis();
+        bool ok = dup || _pending.push(fd);
+        _unlock();
+        if (dup) return !::close(fd);
+        if (!ok) {
+            ok = _sync(fd);
+            ::close(fd);
+        }
+        return ok;
+    }
+};
+
+inline bool PosixFile::close() {
+    if (_fd < 0) return 1;
+    bool ok = _flush();
+    free(_buf);
+    _buf = nullptr;
+    if (_dfd >= 0) ::close(_dfd);
+#ifdef POSIX_FADV_DONTNEED
+    // записанный образ больше не читается - освобождаем кэш (грязные страницы ОС освободит после записи)
+    if (_dirty && _st->_advise) posix_fadvise(_fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    ok = _st->_closed(_fd, _dirty) && ok;
+    _fd = _dfd = -1;
+    return ok;
+}
+
+}  // namespace gdb
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+#include <Arduino.h>
+
+#if defined(ESP32) || defined(__unix__) || defined(__APPLE__)
+#define DB_USE_PTHREAD
+#include <pthread.h>
+#endif
+
+namespace gdb {
+
+// блокировка "много читателей - один писатель". На платформах без потоков - пустышка
+class RWLock {
+   public:
+#ifdef DB_USE_PTHREAD
+    RWLock() {
+        pthread_rwlock_init(&_lock, nullptr);
+    }
+    ~RWLock() {
+        pthread_rwlock_destroy(&_lock);
+    }
+
+    void lockRead() { pthread_rwlock_rdlock(&_lock); }
+    void unlockRead() { pthread_rwlock_unlock(&_lock); }
+    void lockWrite() { pthread_rwlock_wrlock(&_lock); }
+    void unlockWrite() { pthread_rwlock_unlock(&_lock); }
+
+   private:
+    pthread_rwlock_t _lock;
+#else
+    RWLock() {}
+
+    void lockRead() {}
+    void unlockRead() {}
+    void lockWrite() {}
+    void unlockWrite() {}
+#endif
+
+   public:
+    RWLock(const RWLock& l) = delete;
+    RWLock& operator=(const RWLock& l) = delete;
+
+    // захват на чтение до конца области видимости
+    class Read {
+       public:
+        Read(RWLock& l) : _l(l) { _l.lockRead(); }
+        ~Read() { _l.unlockRead(); }
+
+       private:
+        RWLock& _l;
+    };
+
+    // захват на запись до конца области видимости
+    class Write {
+       public:
+        Write(RWLock& l) : _l(l) { _l.lockWrite(); }
+        ~Write() { _l.unlockWrite(); }
+
+       private:
+        RWLock& _l;
+    };
+};
+
+}  // namespace gdb
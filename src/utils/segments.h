@@ -0,0 +1,281 @@
+#pragma once
+#include <Arduino.h>
+#include <GTL.h>
+
+#include "io.h"
+#include "rwlock.h"
+
+// образ из независимых сегментов: сегменты кодируются и разбираются параллельно в нескольких потоках
+
+#ifndef DB_SEG_WAVE
+#define DB_SEG_WAVE 4  // сегментов на поток в памяти одновременно
+#endif
+
+namespace gdb {
+
+#ifdef DB_USE_PTHREAD
+template <typename F>
+struct par_t {
+    F* fn;
+    size_t n;
+    uint8_t step, idx;
+
+    static void* run(void* p) {
+        par_t* c = (par_t*)p;
+        for (size_t i = c->idx; i < c->n; i += c->step) (*c->fn)(i);
+        return nullptr;
+    }
+};
+#endif
+
+// выполнить fn(i) для i от 0 до n в threads потоках. Без потоков - по очереди
+template <typename F>
+void parallelFor(size_t n, uint8_t threads, F fn) {
+#ifdef DB_USE_PTHREAD
+    if (threads > n) threads = n;
+    par_t<F>* ctx = (threads > 1) ? (par_t<F>*)malloc(threads * sizeof(par_t<F>)) : nullptr;
+    pthread_t* th = ctx ? (pthread_t*)malloc(threads * sizeof(pthread_t)) : nullptr;
+    if (th) {
+        // step = 0 - поток не создан, его часть выполняется здесь
+        for (uint8_t t = 0; t < threads; t++) {
+            ctx[t] = par_t<F>{&fn, n, threads, t};
+            if (t && pthread_create(&th[t], nullptr, par_t<F>::run, &ctx[t])) ctx[t].step = 0;
+        }
+        for (uint8_t t = 0; t < threads; t++) {
+            if (!t || !ctx[t].step) {
+                ctx[t].step = threads;
+                par_t<F>::run(&ctx[t]);
+                ctx[t].step = 0;
+            }
+        }
+        for (uint8_t t = 1; t < threads; t++) {
+            if (ctx[t].step) pthread_join(th[t], nullptr);
+        }
+        free(th);
+        free(ctx);
+        return;
+    }
+    free(ctx);
+#else
+    (void)threads;
+#endif
+    for (size_t i = 0; i < n; i++) fn(i);
+}
+
+// заголовок сегмента: размер и CRC записей считаются холостым кодированием
+inline seg_t segmentHead(const block_t* blocks, size_t len, uint8_t mode) {
+    SizeCounter cnt;
+    ImageWriter<SizeCounter> img(cnt);
+    img.start(mode);
+    for (size_t i = 0; i < len; i++) img.record(blocks[i]);
+    return seg_t{(uint32_t)blocks[0].keyHash(), (uint32_t)blocks[len - 1].keyHash(), (uint32_t)len, (uint32_t)img.written, img.crc};
+}
+
+// экспортный размер образа из сегментов по per записей
+inline size_t segmentsSize(const block_t* blocks, size_t len, uint8_t mode, uint32_t per) {
+    if (DB_IMAGE_VER < 2 || !per) return imageSize(blocks, len, mode);
+    size_t sz = sizeof(image_t) + 4;
+    for (size_t i = 0; i < len; i += per) {
+        size_t n = (len - i < per) ? (len - i) : per;
+        sz += sizeof(seg_t);
+        if (mode & DB_IMAGE_COMPACT) sz += segmentHead(blocks + i, n, mode).size;
+        else sz += imageSize(blocks + i, n) - imageSize(nullptr, 0);
+    }
+    return sz;
+}
+
+// записать образ из сегментов по per записей. Сегменты кодируются в threads потоках в память и пишутся по порядку
+template <typename T>
+bool writeSegmentsRaw(T& writer, const block_t* blocks, size_t len, uint8_t mode, uint32_t per, uint8_t threads) {
+#if DB_IMAGE_VER >= 2
+    if (!per) return writeImageRaw(writer, blocks, len, mode);
+    struct job_t {
+        seg_t h;
+        uint8_t* data;
+    };
+    ImageWriter<T> img(writer);
+    img.start(mode);
+    image_t h{DB_IMAGE_MAGIC, DB_IMAGE_VER, (uint8_t)(DB_IMAGE_SORTED | DB_IMAGE_SEGMENTS | (mode & (DB_IMAGE_COMPACT | DB_IMAGE_LZ))), 0, (uint32_t)len};
+    if (!(mode & DB_IMAGE_COMPACT)) h.flags &= ~DB_IMAGE_LZ;
+    if (writer.write((uint8_t*)&h, sizeof(h)) != sizeof(h)) return 0;
+
+    uint32_t hcrc = 0;
+    size_t nseg = (len + per - 1) / per;
+    size_t wave = (threads > 1) ? (size_t)threads * DB_SEG_WAVE : 1;
+    job_t* jobs = (threads > 1) ? (job_t*)malloc(wave * sizeof(job_t)) : nullptr;
+    if (!jobs) wave = 1;  // нет потоков или памяти под задания - по одному сегменту
+    bool ok = true;
+
+    for (size_t base = 0; ok && base < nseg; base += wave) {
+        size_t n = (nseg - base < wave) ? (nseg - base) : wave;
+        if (!jobs) {
+            // один поток: заголовок холостым проходом, затем записи прямо в приёмник
+            const block_t* b = blocks + base * per;
+            size_t cnt = (len - base * per < per) ? (len - base * per) : per;
+            seg_t sh = segmentHead(b, cnt, mode);
+            hcrc = crc32(hcrc, &sh, sizeof(sh));
+            ok = writer.write((uint8_t*)&sh, sizeof(sh)) == sizeof(sh);
+            img.start(mode);
+            for (size_t i = 0; ok && i < cnt; i++) ok = img.record(b[i]);
+            ok = ok && img.written == sh.size;
+            continue;
+        }
+        parallelFor(n, threads, [&](size_t i) {
+            const block_t* b = blocks + (base + i) * per;
+            size_t cnt = (len - (base + i) * per < per) ? (len - (base + i) * per) : per;
+            job_t& j = jobs[i];
+            j.h = segmentHead(b, cnt, mode);
+            j.data = (uint8_t*)malloc(j.h.size ? j.h.size : 1);
+            if (!j.data) return;
+            Writer w(j.data);
+            ImageWriter<Writer> sw(w);
+            sw.start(mode);
+            for (size_t k = 0; k < cnt; k++) sw.record(b[k]);
+        });
+        for (size_t i = 0; i < n; i++) {
+            job_t& j = jobs[i];
+            if (ok && j.data) {
+                hcrc = crc32(hcrc, &j.h, sizeof(j.h));
+                ok = writer.write((uint8_t*)&j.h, sizeof(j.h)) == sizeof(j.h) && writer.write(j.data, j.h.size) == j.h.size;
+            } else {
+                ok = false;
+            }
+            free(j.data);
+        }
+    }
+    free(jobs);
+    return ok && writer.write((uint8_t*)&hcrc, 4) == 4;
+#else
+    (void)per;
+    (void)threads;
+    return writeImageRaw(writer, blocks, len, mode);
+#endif
+}
+
+// записать образ из сегментов блоками по DB_IO_BUF байт
+template <typename T>
+bool writeSegments(T& writer, const block_t* blocks, size_t len, uint8_t mode, uint32_t per, uint8_t threads) {
+    WriterSink<T> sink(writer);
+    BufWriter buf(sink);
+    bool ok = writeSegmentsRaw(buf, blocks, len, mode, per, threads);
+    return buf.flush() && ok;
+}
+
+// прочитать сегменты образа после заголовка. Сегменты читаются волнами по threads * DB_SEG_WAVE и разбираются
+// параллельно, каждый в свой массив. Затем массивы склеиваются, если диапазоны ключей не пересекаются, иначе сливаются.
+// out(block_t&) получает ячейки по порядку хэшей и забирает их, вернёт false при ошибке
+template <typename F>
+bool readSegments(Reader& reader, ImageReader& img, uint8_t threads, F out) {
+    struct part_t {
+        seg_t h;
+        uint8_t* data;
+        block_t* blocks;
+        uint32_t len, pos;
+        bool ok;
+    };
+    gtl::stack<part_t> parts;
+    size_t total = 0, wave = (size_t)(threads ? threads : 1) * DB_SEG_WAVE;
+    uint32_t hcrc = 0;
+    bool ok = true;
+
+    while (ok && total < img.len) {
+        size_t from = parts.length();
+        while (total < img.len && parts.length() - from < wave) {
+            part_t p{};
+            if (!reader.read(p.h) || !p.h.count || p.h.count > img.len - total) {
+                ok = false;
+                break;
+            }
+            hcrc = crc32(hcrc, &p.h, sizeof(p.h));
+            p.data = (uint8_t*)malloc(p.h.size ? p.h.size : 1);
+            p.blocks = (block_t*)malloc(p.h.count * sizeof(block_t));
+            if (!p.data || !p.blocks || !reader.read(p.data, p.h.size) || !parts.push(p)) {
+                free(p.data);
+                free(p.blocks);
+                ok = false;
+                break;
+            }
+            total += p.h.count;
+        }
+
+        parallelFor(parts.length() - from, threads, [&](size_t i) {
+            part_t& p = parts[from + i];
+            Reader r(p.data, p.h.size);
+            ImageReader sr;
+            sr.segment(img.flags, p.h.count);
+            p.ok = true;
+            while (p.len < p.h.count) {
+                block_t b;
+                if (!sr.next(r, b)) {
+                    p.ok = false;
+                    break;
+                }
+                p.blocks[p.len++] = b;
+            }
+            p.ok = p.ok && sr.crc == p.h.crc && !r.available();
+            // неотсортированный образ: сегмент сортируется для слияния
+            if (p.ok && !(img.flags & DB_IMAGE_SORTED)) {
+                qsort(p.blocks, p.len, sizeof(block_t), [](const void* a, const void* b) -> int {
+                    size_t ha = ((const block_t*)a)->keyHash(), hb = ((const block_t*)b)->keyHash();
+                    return (ha > hb) - (ha < hb);
+                });
+            }
+            // склейка и слияние опираются на порядок ключей и диапазон из заголовка - сегмент с нарушенным порядком,
+            // повтором ключа или чужим диапазоном отклоняется
+            for (uint32_t k = 1; p.ok && k < p.len; k++) p.ok = p.blocks[k - 1].keyHash() < p.blocks[k].keyHash();
+            p.ok = p.ok && p.blocks[0].keyHash() == p.h.first && p.blocks[p.len - 1].keyHash() == p.h.last;
+        });
+        for (size_t i = from; i < parts.length(); i++) {
+            free(parts[i].data);
+            parts[i].data = nullptr;
+            ok = ok && parts[i].ok;
+        }
+    }
+    if (ok) {
+        uint32_t c;
+        ok = reader.read(c) && c == hcrc;
+    }
+
+    if (ok) {
+        bool merge = !(img.flags & DB_IMAGE_SORTED);
+        for (size_t i = 1; i < parts.length(); i++) {
+            if (parts[i].h.first <= parts[i - 1].h.last) merge = true;
+        }
+        if (!merge) {
+            // диапазоны не пересекаются - склеиваем по порядку
+            for (size_t i = 0; ok && i < parts.length(); i++) {
+                part_t& p = parts[i];
+                while (ok && p.pos < p.len) ok = out(p.blocks[p.pos++]);
+            }
+        } else {
+            // слияние: при совпадении ключей остаётся ячейка из более позднего сегмента
+            while (ok) {
+                int min = -1;
+                for (size_t i = 0; i < parts.length(); i++) {
+                    part_t& p = parts[i];
+                    if (p.pos >= p.len) continue;
+                    if (min < 0 || p.blocks[p.pos].keyHash() <= parts[min].blocks[parts[min].pos].keyHash()) {
+                        if (min >= 0 && p.blocks[p.pos].keyHash() == parts[min].blocks[parts[min].pos].keyHash()) {
+                            parts[min].blocks[parts[min].pos++].reset();
+                        }
+                        min = i;
+                    }
+                }
+                if (min < 0) break;
+                ok = out(parts[min].blocks[parts[min].pos++]);
+            }
+        }
+    }
+
+    // невыданные ячейки освобождаются
+    for (size_t i = 0; i < parts.length(); i++) {
+        part_t& p = parts[i];
+        while (p.pos < p.len) p.blocks[p.pos++].reset();
+        free(p.data);
+        free(p.blocks);
+    }
+    parts.reset();
+    return ok;
+}
+
+}  // namespace gdb
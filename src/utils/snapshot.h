@@ -0,0 +1,229 @@
+#pragma once
+#include <Arduino.h>
+#include <GTL.h>
+
+#include "block.h"
+#include "entry.h"
+#include "io.h"
+#include "rwlock.h"
+
+#ifdef DB_USE_PTHREAD
+#include <atomic>
+#endif
+
+namespace gdb {
+
+struct snap_t;
+
+// новейший снимок БД. Атомарный: БД проверяет наличие снимков без блокировки, а снимок может освободиться в другом потоке
+#ifdef DB_USE_PTHREAD
+typedef std::atomic<snap_t*> snap_head_t;
+#else
+typedef snap_t* snap_head_t;
+#endif
+
+// данные снимка: копия массива ячеек, динамические данные общие с БД.
+// Цепочка снимков (older/newer/head) и owned меняются только под Lock: снимок может освобождаться в другом потоке,
+// пока БД отдаёт ему данные, а также после удаления БД
+struct snap_t {
+    struct own_t {
+        uint32_t hash;
+        void* ptr;
+    };
+
+    // блокировка цепочек снимков. Общая для всех БД - переживает удаление БД
+    class Lock {
+       public:
+#ifdef DB_USE_PTHREAD
+        Lock() {
+            pthread_mutex_lock(&_mutex());
+        }
+        ~Lock() {
+            pthread_mutex_unlock(&_mutex());
+        }
+
+       private:
+        static pthread_mutex_t& _mutex() {
+            static pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+            return m;
+        }
+#else
+        Lock() {}
+#endif
+       public:
+        Lock(const Lock& l) = delete;
+        Lock& operator=(const Lock& l) = delete;
+    };
+
+    block_t* blocks = nullptr;
+    size_t len = 0;
+    gtl::stack<own_t> owned;  // данные, отданные БД снимку при изменении ячеек
+#ifdef DB_USE_PTHREAD
+    std::atomic<uint16_t> refs{1};  // копии Snapshot в разных потоках
+#else
+    uint16_t refs = 1;
+#endif
+    uint8_t mode = 0;  // формат образа writeTo (компактный) на момент снимка
+    snap_t* older = nullptr;
+    snap_t* newer = nullptr;
+    snap_head_t* head = nullptr;  // новейший снимок в БД (nullptr если БД удалена)
+
+    // создать снимок массива ячеек и сделать его новейшим. Массив копируется целиком: O(len)
+    static snap_t* create(const block_t* buf, size_t len, snap_head_t* head) {
+        snap_t* s = new snap_t();
+        if (!s) return nullptr;
+        if (len) {
+            s->blocks = (block_t*)malloc(len * sizeof(block_t));
+            if (!s->blocks) {
+                delete s;
+                return nullptr;
+            }
+            memcpy((void*)s->blocks, (const void*)buf, len * sizeof(block_t));
+        }
+        Lock l;
+        s->len = len;
+        s->head = head;
+        s->older = (snap_t*)*head;
+        if (s->older) s->older->newer = s;
+        *head = s;
+        return s;
+    }
+
+    // индекс ячейки или -1
+    int indexOf(size_t hash) const {
+        hash &= DB_HASH_MASK;
+        int low = 0, high = (int)len - 1;
+        while (low <= high) {
+            int mid = low + ((high - low) >> 1);
+            if (blocks[mid].keyHash() == hash) return mid;
+            if (blocks[mid].keyHash() < hash) low = mid + 1;
+            else high = mid - 1;
+        }
+        return -1;
+    }
+
+    // снимок видит эти динамические данные ячейки. Вызывать под Lock
+    bool refers(size_t hash, const void* ptr) const {
+        int i = indexOf(hash);
+        return i >= 0 && blocks[i].ptr() == ptr;
+    }
+
+    // забрать данные ячейки, которые БД больше не использует. Вызывать под Lock
+    void own(size_t hash, void* ptr) {
+        // при нехватке памяти данные не освобождаются - утечка лучше порчи снимка
+        owned.push(own_t{(uint32_t)(hash & DB_HASH_MASK), ptr});
+    }
+
+    // отпустить ссылку. Последняя ссылка удаляет снимок
+    void release() {
+        if (--refs) return;
+        Lock l;
+
+        // данные могут быть нужны более старому снимку - тогда передаём ему
+        for (size_t i = 0; i < owned.length(); i++) {
+            if (older && older->refers(owned[i].hash, owned[i].ptr)) older->own(owned[i].hash, owned[i].ptr);
+            else free(owned[i].ptr);
+        }
+        if (older) older->newer = newer;
+        if (newer) newer->older = older;
+        else if (head) *head = older;
+        free(blocks);
+        delete this;
+    }
+
+    // БД удалена: отвязать все снимки цепочки
+    static void detachAll(snap_head_t* head) {
+        Lock l;
+        for (snap_t* s = *head; s; s = s->older) s->head = nullptr;
+        *head = nullptr;
+    }
+
+    // обменять цепочки двух БД и перепривязать снимки
+    static void swapChains(snap_head_t* a, snap_head_t* b) {
+        Lock l;
+        snap_t* t = *a;
+        *a = (snap_t*)*b;
+        *b = t;
+        for (snap_t* s = *a; s; s = s->older) s->head = a;
+        for (snap_t* s = *b; s; s = s->older) s->head = b;
+    }
+};
+
+// неизменяемый снимок БД. Можно копировать - данные общие
+class Snapshot {
+   public:
+    Snapshot() {}
+    Snapshot(snap_t* s) : _s(s) {}
+    Snapshot(const Snapshot& s) : _s(s._s) {
+        if (_s) _s->refs++;
+    }
+    Snapshot& operator=(const Snapshot& s) {
+        if (this != &s) {
+            release();
+            _s = s._s;
+            if (_s) _s->refs++;
+        }
+        return *this;
+    }
+
+    ~Snapshot() {
+        release();
+    }
+
+    // освободить снимок
+    void release() {
+        if (_s) _s->release();
+        _s = nullptr;
+    }
+
+    // снимок создан
+    bool valid() const {
+        return _s;
+    }
+    explicit operator bool() const {
+        return valid();
+    }
+
+    // количество ячеек
+    size_t length() const {
+        return _s ? _s->len : 0;
+    }
+
+    // получить ячейку
+    Entry get(size_t hash) const {
+        int i = _s ? _s->indexOf(hash) : -1;
+        return (i >= 0) ? Entry(_s->blocks[i]) : Entry();
+    }
+    Entry get(const Text& key) const {
+        return get(key.hash());
+    }
+
+    // получить ячейку по порядку
+    Entry getN(int idx) const {
+        return (_s && idx >= 0 && idx < (int)_s->len) ? Entry(_s->blocks[idx]) : Entry();
+    }
+
+    // снимок содержит ячейку
+    bool has(size_t hash) const {
+        return _s && _s->indexOf(hash) >= 0;
+    }
+    bool has(const Text& key) const {
+        return has(key.hash());
+    }
+
+    // экспортный размер снимка (для writeTo)
+    size_t writeSize() const {
+        return _s ? imageSize(_s->blocks, _s->len, _s->mode) : 0;
+    }
+
+    // экспортировать снимок в Stream в формате GyverDB
+    template <typename T>
+    bool writeTo(T& writer) const {
+        return _s && writeImage(writer, _s->blocks, _s->len, _s->mode);
+    }
+
+   private:
+    snap_t* _s = nullptr;
+};
+
+}  // namespace gdb
@@ -0,0 +1,191 @@
+#pragma once
+#include <Arduino.h>
+
+#include "bufio.h"
+
+#if !defined(DB_NO_FS) && (!defined(__has_include) || __has_include(<FS.h>))
+#define DB_USE_FS
+#include <FS.h>
+#endif
+
+namespace gdb {
+
+// открытый файл хранилища
+class StorageFile {
+   public:
+    virtual ~StorageFile() {}
+
+    virtual size_t read(uint8_t* buf, size_t len) = 0;
+    virtual size_t write(const uint8_t* buf, size_t len) = 0;
+    virtual bool seek(size_t pos) = 0;
+    virtual size_t position() = 0;
+    virtual size_t size() = 0;
+
+    // закрыть файл. Вернёт false, если данные не записаны
+    virtual bool close() = 0;
+};
+
+// хранилище файлов БД (файловая система Arduino, POSIX, своё)
+class Storage {
+   public:
+    virtual ~Storage() {}
+
+    // открыть файл: "r" - чтение, "w" - запись с начала, "a" - дозапись. nullptr при ошибке
+    virtual StorageFile* open(const char* path, const char* mode) = 0;
+    virtual bool exists(const char* path) = 0;
+    virtual bool remove(const char* path) = 0;
+
+    // переименовать. Существующий файл заменяется, если ФС это умеет
+    virtual bool rename(const char* from, const char* to) = 0;
+
+    // записать на носитель отложенные данные закрытых файлов
+    virtual bool sync() {
+        return 1;
+    }
+
+    // тикер отложенной записи на носитель
+    virtual void tick() {}
+};
+
+// файл хранилища как Stream. Владеет открытым файлом, закрывает его при уничтожении
+class DBFile : public Stream, public Source {
+   public:
+    DBFile(StorageFile* f = nullptr) : _f(f) {}
+
+    DBFile(DBFile&& f) noexcept : _f(f._f) {
+        f._f = nullptr;
+    }
+    DBFile& operator=(DBFile&& f) noexcept {
+        if (this != &f) {
+            close();
+            _f = f._f;
+            f._f = nullptr;
+        }
+        return *this;
+    }
+    DBFile(const DBFile& f) = delete;
+    DBFile& operator=(const DBFile& f) = delete;
+
+    ~DBFile() {
+        close();
+    }
+
+    int available() override {
+        if (!_f) return 0;
+        size_t left = _f->size() - _f->position();
+        return left > 0x7fffffff ? 0x7fffffff : left;
+    }
+    int read() override {
+        uint8_t b;
+        return read(&b, 1) ? b : -1;
+    }
+    int peek() override {
+        int b = read();
+        if (b >= 0) _f->seek(_f->position() - 1);
+        return b;
+    }
+    size_t read(uint8_t* buf, size_t len) override {
+        return _f ? _f->read(buf, len) : 0;
+    }
+    size_t readBytes(uint8_t* buf, size_t len) {
+        return read(buf, len);
+    }
+    size_t readBytes(char* buf, size_t len) {
+        return read((uint8_t*)buf, len);
+    }
+    size_t write(uint8_t b) override {
+        return write(&b, 1);
+    }
+    size_t write(const uint8_t* buf, size_t len) override {
+        return _f ? _f->write(buf, len) : 0;
+    }
+
+    bool seek(size_t pos) {
+        return _f && _f->seek(pos);
+    }
+    size_t position() {
+        return _f ? _f->position() : 0;
+    }
+    size_t size() {
+        return _f ? _f->size() : 0;
+    }
+
+    // закрыть файл. Вернёт false, если данные не записаны
+    bool close() {
+        if (!_f) return 1;
+        bool ok = _f->close();
+        delete _f;
+        _f = nullptr;
+        return ok;
+    }
+
+    explicit operator bool() const {
+        return _f;
+    }
+
+   private:
+    StorageFile* _f;
+};
+
+#ifdef DB_USE_FS
+// файл ФС Arduino
+class FSFile : public StorageFile {
+   public:
+    FSFile(const fs::File& f) : _f(f) {}
+
+    size_t read(uint8_t* buf, size_t len) override {
+        return _f.read(buf, len);
+    }
+    size_t write(const uint8_t* buf, size_t len) override {
+        return _f.write(buf, len);
+    }
+    bool seek(size_t pos) override {
+        return _f.seek(pos);
+    }
+    size_t position() override {
+        return _f.position();
+    }
+    size_t size() override {
+        return _f.size();
+    }
+    bool close() override {
+        _f.close();
+        return 1;
+    }
+
+   private:
+    fs::File _f;
+};
+
+// хранилище поверх файловой системы Arduino (LittleFS, SPIFFS, SD)
+class FSStorage : public Storage {
+   public:
+    FSStorage(fs::FS* fs = nullptr) : _fs(fs) {}
+
+    // файловая система
+    fs::FS* fs() {
+        return _fs;
+    }
+
+    StorageFile* open(const char* path, const char* mode) override {
+        if (!_fs) return nullptr;
+        fs::File f = _fs->open(path, mode);
+        if (!f) return nullptr;
+        return new FSFile(f);
+    }
+    bool exists(const char* path) override {
+        return _fs && _fs->exists(path);
+    }
+    bool remove(const char* path) override {
+        return _fs && _fs->remove(path);
+    }
+    bool rename(const char* from, const char* to) override {
+        return _fs && _fs->rename(from, to);
+    }
+
+   private:
+    fs::FS* _fs;
+};
+#endif
+
+}  // namespace gdb
@@ -0,0 +1,197 @@
+#pragma once
+#include <Arduino.h>
+#include <GTL.h>
+
+#include "hashmap.h"
+#include "updates.h"
+
+#ifndef __AVR__
+#include <functional>
+#endif
+
+namespace gdb {
+
+// обработчик изменения ключа вида void f(size_t hash). Кроме AVR может захватывать контекст (лямбда, std::bind)
+#ifdef __AVR__
+typedef void (*SubCallback)(size_t hash);
+#else
+typedef std::function<void(size_t hash)> SubCallback;
+#endif
+
+// реестр подписчиков на изменения ключей
+class Subscribers {
+    struct sub_t {
+        uint16_t id;
+        SubCallback cb;
+        gtl::stack<size_t> keys;  // пустой - подписка на все ключи
+    };
+    struct node_t {
+        uint16_t sub;
+        int16_t next;
+    };
+
+   public:
+    Subscribers() {}
+    Subscribers(const Subscribers& s) = delete;
+    Subscribers& operator=(const Subscribers& s) = delete;
+
+    ~Subscribers() {
+        reset();
+    }
+
+    // подписаться на список ключей (len 0 - на все). Вернёт id подписки или 0 при ошибке
+    uint16_t add(const size_t* hashes, size_t len, SubCallback cb) {
+        if (!cb) return 0;
+        sub_t* sub = new sub_t();
+        if (!sub) return 0;
+        sub->id = ++_id ? _id : ++_id;
+        sub->cb = cb;
+        bool ok = sub->keys.reserve(len);
+        for (size_t i = 0; ok && i < len; i++) ok = sub->keys.push(hashes[i] & DB_HASH_MASK);
+        if (ok && _subs.push(sub) && _index(_subs.length() - 1)) return sub->id;
+
+        if (_subs.length() && _subs[_subs.length() - 1] == sub) _subs.pop();
+        delete sub;
+        _rebuild();
+        return 0;
+    }
+
+    // отписаться
+    void remove(uint16_t id) {
+        for (size_t i = 0; i < _subs.length(); i++) {
+            if (_subs[i]->id == id) {
+                if (_busy) {
+                    // удаление изнутри обработчика - откладываем до конца рассылки
+                    _subs[i]->cb = nullptr;
+                    _dirty = true;
+                } else {
+                    delete _subs[i];
+                    _subs.remove(i);
+                    _rebuild();
+                }
+                return;
+            }
+        }
+    }
+
+    // есть подписчики
+    bool active() const {
+        return _subs.length();
+    }
+
+    // откладывать рассылку до вызова tick(). size - размер очереди
+    void defer(bool defer, uint16_t size = 32) {
+        tick();
+        _defer = defer;
+        _queue.setSize(size);
+    }
+
+    // сообщить об изменении ключа
+    void notify(size_t hash) {
+        if (!active()) return;
+        if (_defer) {
+            if (_queue.has(hash)) return;
+            if (_queue.full()) _dispatch(_queue.pop());  // не теряем события при переполнении
+            if (_queue.push(hash)) return;
+        }
+        _dispatch(hash);
+    }
+
+    // разослать отложенные изменения. Вернёт true, если были изменения
+    bool tick() {
+        if (!_queue.length()) return 0;
+        while (_queue.length()) _dispatch(_queue.pop());
+        return 1;
+    }
+
+    // обменяться подписчиками
+    void swap(Subscribers& s) noexcept {
+        _swap(_subs, s._subs);
+        _swap(_nodes, s._nodes);
+        _swap(_all, s._all);
+        _heads.swap(s._heads);
+        _queue.swap(s._queue);
+        gtl::swap(_id, s._id);
+        gtl::swap(_defer, s._defer);
+        gtl::swap(_dirty, s._dirty);
+    }
+
+    // удалить всех подписчиков
+    void reset() {
+        for (size_t i = 0; i < _subs.length(); i++) delete _subs[i];
+        _subs.reset();
+        _nodes.reset();
+        _heads.reset();
+        _all.reset();
+        _queue.reset();
+    }
+
+   private:
+    gtl::stack<sub_t*> _subs;
+    gtl::stack<node_t> _nodes;  // цепочки подписчиков по ключу
+    HashMap<int16_t> _heads;    // ключ -> первый узел цепочки
+    gtl::stack<uint16_t> _all;  // подписчики на все ключи
+    Updates _queue;
+    uint16_t _id = 0;
+    bool _defer = false;
+    uint8_t _busy = 0;
+    bool _dirty = false;
+
+    void _dispatch(size_t hash) {
+        hash &= DB_HASH_MASK;
+        _busy++;
+        for (size_t i = 0; i < _all.length(); i++) {
+            sub_t* sub = _subs[_all[i]];
+            if (sub->cb) sub->cb(hash);
+        }
+        int16_t* head = _heads.get(hash);
+        for (int16_t n = head ? *head : -1; n >= 0; n = _nodes[n].next) {
+            sub_t* sub = _subs[_nodes[n].sub];
+            if (sub->cb) sub->cb(hash);
+        }
+        _busy--;
+
+        if (_dirty && !_busy) {
+            _dirty = false;
+            for (size_t i = 0; i < _subs.length();) {
+                if (_subs[i]->cb) {
+                    i++;
+                } else {
+                    delete _subs[i];
+                    _subs.remove(i);
+                }
+            }
+            _rebuild();
+        }
+    }
+
+    // добавить подписчика в индекс
+    bool _index(uint16_t idx) {
+        sub_t* sub = _subs[idx];
+        if (!sub->keys.length()) return _all.push(idx);
+
+        for (size_t k = 0; k < sub->keys.length(); k++) {
+            int16_t* head = _heads.get(sub->keys[k]);
+            if (!_nodes.push(node_t{idx, head ? *head : (int16_t)-1})) return 0;
+            if (!_heads.put(sub->keys[k], _nodes.length() - 1)) return 0;
+        }
+        return 1;
+    }
+
+    template <typename T>
+    static void _swap(gtl::stack<T>& a, gtl::stack<T>& b) {
+        gtl::stack<T> t;
+        t.move(a);
+        a.move(b);
+        b.move(t);
+    }
+
+    void _rebuild() {
+        _nodes.clear();
+        _heads.clear();
+        _all.clear();
+        for (size_t i = 0; i < _subs.length(); i++) _index(i);
+    }
+};
+
+}  // namespace gdb
@@ -0,0 +1,122 @@
+#pragma once
+#include <Arduino.h>
+#include <GTL.h>
+
+#include "hashmap.h"
+
+namespace gdb {
+
+// поведение очереди обновлений при переполнении
+enum class Overflow : uint8_t {
+    DropOldest,  // вытеснить самое старое обновление
+    Resync,      // очистить очередь и поднять флаг полной синхронизации
+};
+
+// FIFO очередь хэшей ограниченного размера без повторов
+class Updates {
+   public:
+    Updates() {}
+    Updates(const Updates& u) = delete;
+    Updates& operator=(const Updates& u) = delete;
+
+    ~Updates() {
+        reset();
+    }
+
+    // установить размер и поведение при переполнении. Очищает очередь
+    void setSize(uint16_t size, Overflow policy = Overflow::DropOldest) {
+        reset();
+        _size = size ? size : 1;
+        _policy = policy;
+    }
+
+    // добавить хэш, если его ещё нет в очереди
+    bool push(size_t hash) {
+        if (has(hash)) return 1;
+        if (!_buf) {
+            _buf = (size_t*)malloc(_size * sizeof(size_t));
+            if (!_buf) return 0;
+        }
+        if (_len >= _size) {
+            if (_policy == Overflow::Resync) {
+                clear();
+                _resync = true;
+            } else {
+                pop();
+            }
+        }
+        if (!_pending.put(hash, 0)) return 0;
+        _buf[(_head + _len) % _size] = hash;
+        _len++;
+        return 1;
+    }
+
+    // получить самый старый хэш (0 если очередь пуста)
+    size_t pop() {
+        if (!_len) return 0;
+        size_t hash = _buf[_head];
+        _head = (_head + 1) % _size;
+        _len--;
+        _pending.remove(hash);
+        return hash;
+    }
+
+    // количество хэшей в очереди
+    uint16_t length() const {
+        return _len;
+    }
+
+    // хэш есть в очереди
+    bool has(size_t hash) const {
+        return _pending.has(hash);
+    }
+
+    // очередь заполнена
+    bool full() const {
+        return _len >= _size;
+    }
+
+    // очередь переполнялась в режиме Resync. Сбрасывает флаг
+    bool resync() {
+        bool r = _resync;
+        _resync = false;
+        return r;
+    }
+
+    // очистить очередь
+    void clear() {
+        _head = _len = 0;
+        _pending.clear();
+    }
+
+    // освободить память
+    void reset() {
+        clear();
+        free(_buf);
+        _buf = nullptr;
+        _pending.reset();
+        _resync = false;
+    }
+
+    // обменяться содержимым
+    void swap(Updates& u) noexcept {
+        _pending.swap(u._pending);
+        gtl::swap(_buf, u._buf);
+        gtl::swap(_size, u._size);
+        gtl::swap(_head, u._head);
+        gtl::swap(_len, u._len);
+        gtl::swap(_policy, u._policy);
+        gtl::swap(_resync, u._resync);
+    }
+
+   private:
+    HashMap<uint8_t> _pending;
+    size_t* _buf = nullptr;
+    uint16_t _size = 32;
+    uint16_t _head = 0;
+    uint16_t _len = 0;
+    Overflow _policy = Overflow::DropOldest;
+    bool _resync = false;
+};
+
+}  // namespace gdb